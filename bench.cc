@@ -0,0 +1,777 @@
+#include <algorithm>
+#include <array>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fixed_kvstore.h"
+#include "kvstore.h"
+#include "sharded_kvstore.h"
+#include "sst_writer.h"
+
+// Micro benchmarks of KVStore, e.g.
+//   ./bench fillrandom,readrandom -n 100000 -v 1000
+// runs the workloads one after another against the same store.
+
+// Draws ranks in [0, n) Zipfian with skew theta < 1, rank 0 the most
+// popular, by the method of Gray et al. that YCSB uses.
+class ZipfGenerator {
+   public:
+    ZipfGenerator(uint64_t n, double theta)
+        : n(n), theta(theta), zetan(zeta(n, theta)) {
+        alpha = 1 / (1 - theta);
+        eta = (1 - std::pow(2.0 / n, 1 - theta)) /
+              (1 - zeta(2, theta) / zetan);
+    }
+
+    uint64_t next(std::mt19937_64 &rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan;
+        if (uz < 1) return 0;
+        if (uz < 1 + std::pow(0.5, theta)) return 1;
+        return std::min(n - 1, (uint64_t)(n * std::pow(eta * u - eta + 1,
+                                                       alpha)));
+    }
+
+   private:
+    uint64_t n;
+    double theta, zetan, alpha, eta;
+
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++) sum += 1 / std::pow(i, theta);
+        return sum;
+    }
+};
+
+struct BenchConfig {
+    std::string dir = "./bench-data";
+    uint64_t num = 100000;
+    uint64_t valueSize = 1000;
+    bool sparse = false;     // spreads the keys over the whole key space
+    uint64_t scanWidth = 100;  // the number of keys a scan covers
+    // readrandom draws keys from a Zipfian distribution of this skew, 0
+    // draws them uniformly
+    double zipf = 0;
+    // the gets readasync keeps in flight, it runs once for each depth
+    std::vector<uint64_t> queueDepths = {16};
+    bool dropCache = false;  // readasync drops the page cache before a run
+    // the writer threads of fillthreads, it runs once for each count
+    std::vector<uint64_t> threads = {1};
+    // the workloads that only use KVStoreAPI run against a ShardedKVStore
+    // of this many shards, 0 uses a KVStore
+    int shards = 0;
+    uint64_t sortMemory = 64 << 20;  // the memory SstWriter sorts runs in
+    uint64_t ttl = 1;  // the seconds the entries of fillttl live
+    Options options;
+};
+
+class Bench {
+   public:
+    Bench(const BenchConfig &config)
+        : config(config),
+          store(config.dir, config.options),
+          rng(301),
+          live(config.num, false) {
+        store.reset();
+        if (config.shards > 0) {
+            sharded = std::unique_ptr<ShardedKVStore>(new ShardedKVStore(
+                config.dir + "/sharded", config.shards, config.options));
+            sharded->reset();
+        }
+    }
+
+    void run(const std::string &name) {
+        auto it = workloads().find(name);
+        if (it == workloads().end()) {
+            std::cerr << "unknown workload " << name << std::endl;
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        uint64_t ops = it->second(*this);
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout << name << ":\t" << ops << " ops in " << elapsed.count()
+                  << " s, " << (uint64_t)(ops / elapsed.count()) << " ops/s, "
+                  << elapsed.count() * 1e6 / ops << " us/op" << std::endl;
+    }
+
+    void report() const {
+        Stats s = sharded ? sharded->getStats() : store.getStats();
+        std::cout << "user bytes:\t" << s.userBytes << std::endl;
+        std::cout << "flush bytes:\t" << s.flushBytes;
+        if (s.flushMicros > 0)
+            std::cout << " in " << s.flushMicros / 1e6 << " s, "
+                      << (double)s.flushBytes / s.flushMicros << " MB/s";
+        std::cout << std::endl;
+        if (s.ingestBytes > 0)
+            std::cout << "ingested bytes:\t" << s.ingestBytes << std::endl;
+        if (s.flushStalls > 0)
+            std::cout << "flush stalls:\t" << s.flushStalls << std::endl;
+        if (s.valueLogBytes > 0)
+            std::cout << "value log bytes:\t" << s.valueLogBytes << std::endl;
+        if (s.expiredEntries > 0)
+            std::cout << "expired entries:\t" << s.expiredEntries << std::endl;
+        std::cout << "compaction:\t" << s.compactions << " merges, "
+                  << s.trivialMoves << " trivial moves, "
+                  << s.compactionBytesRead << " bytes read, "
+                  << s.compactionBytesWritten << " bytes written in "
+                  << s.compactionMicros / 1e6 << " s" << std::endl;
+        std::cout << "write amp:\t" << s.writeAmplification() << std::endl;
+        // the size of the live entries if they were in a single table
+        uint64_t liveBytes = 0;
+        for (bool l : live)
+            if (l) liveBytes += config.valueSize + 40;
+        if (liveBytes > 0)
+            std::cout << "space amp:\t"
+                      << (double)sizeOnDisk() / liveBytes << ", "
+                      << (double)sizeOnDisk() * (config.valueSize + 40) /
+                             liveBytes
+                      << " bytes per live key" << std::endl;
+        if (s.gets > 0)
+            std::cout << "read probes:\t" << (double)s.tableProbes / s.gets
+                      << " tables per get" << std::endl;
+        if (sharded) {
+            std::cout << "shards:\t" << sharded->size() << std::endl;
+            return;
+        }
+        uint64_t liveKeys = std::count(live.begin(), live.end(), true);
+        uint64_t indexBytes =
+            store.indexMemoryBytes() + store.cachedIndexBytes();
+        std::cout << "index memory:\t" << store.indexMemoryBytes()
+                  << " bytes pinned, " << store.cachedIndexBytes()
+                  << " bytes cached";
+        if (liveKeys > 0)
+            std::cout << ", " << (double)indexBytes / liveKeys
+                      << " per live key";
+        std::cout << std::endl;
+        if (s.filterSkips + s.scanTableReads > 0)
+            std::cout << "range filter:\t" << s.filterSkips
+                      << " tables skipped, " << s.scanTableReads
+                      << " tables read by scans" << std::endl;
+        if (s.rowCacheHits > 0)
+            std::cout << "row cache:\t" << s.rowCacheHits << " hits, "
+                      << s.gets << " misses, " << store.cachedRowBytes()
+                      << " bytes" << std::endl;
+        if (s.indexCacheHits + s.indexCacheMisses > 0)
+            std::cout << "index cache:\t" << s.indexCacheHits << " hits, "
+                      << s.indexCacheMisses << " misses" << std::endl;
+    }
+
+   private:
+    using Workload = std::function<uint64_t(Bench &)>;
+
+    BenchConfig config;
+    KVStore store;
+    std::mt19937_64 rng;
+    std::vector<bool> live;  // whether a key holds a value
+    // values kept pinned by readpinned, for checkpinned
+    std::vector<std::pair<uint64_t, PinnedValue>> pinned;
+    std::unique_ptr<ShardedKVStore> sharded;  // nullptr without --shards
+    std::unique_ptr<ZipfGenerator> zipf;  // nullptr until readKey needs it
+
+    // the values of the fixed-width workloads, compare with -v 16
+    using FixedValue = std::array<char, 16>;
+    std::unique_ptr<FixedKVStore<FixedValue>> fixedStore;
+
+    // the store of the fixed-width workloads under dir/fixed, emptied on
+    // first use
+    FixedKVStore<FixedValue> &fixed() {
+        if (!fixedStore) {
+            fixedStore.reset(new FixedKVStore<FixedValue>(
+                config.dir + "/fixed", config.options));
+            fixedStore->reset();
+        }
+        return *fixedStore;
+    }
+
+    FixedValue fixedValue(uint64_t key) const {
+        FixedValue v;
+        v.fill('a' + key % 26);
+        return v;
+    }
+
+    KVStoreAPI &api() {
+        if (sharded) return *sharded;
+        return store;
+    }
+
+    uint64_t sizeOnDisk() const {
+        return sharded ? sharded->sizeOnDisk() : store.sizeOnDisk();
+    }
+
+    std::string value(uint64_t key) const {
+        return std::string(config.valueSize, 'a' + key % 26);
+    }
+
+    uint64_t randomKey() { return rng() % config.num; }
+
+    // a key of readrandom, the popular ranks are scattered over the keys
+    uint64_t readKey() {
+        if (config.zipf == 0) return randomKey();
+        if (!zipf) zipf.reset(new ZipfGenerator(config.num, config.zipf));
+        uint64_t rank = zipf->next(rng);
+        return (rank * 0x9e3779b97f4a7c15ULL >> 17) % config.num;
+    }
+
+    // the key in the store of key i
+    uint64_t storeKey(uint64_t i) const {
+        if (!config.sparse) return i;
+        // splitmix64, a bijection
+        i += 0x9e3779b97f4a7c15ULL;
+        i = (i ^ (i >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        i = (i ^ (i >> 27)) * 0x94d049bb133111ebULL;
+        return i ^ (i >> 31);
+    }
+
+    // needs root, makes the next reads go to the disk
+    static void dropPageCache() {
+        sync();
+        std::ofstream("/proc/sys/vm/drop_caches") << "3" << std::endl;
+    }
+
+    // random gets through getAsync with depth of them in flight
+    void readAsync(uint64_t depth) {
+        std::mutex mutex;
+        std::condition_variable cv;
+        uint64_t inflight = 0, found = 0, wrong = 0;
+        for (uint64_t i = 0; i < config.num; i++) {
+            uint64_t key = randomKey();
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return inflight < depth; });
+                inflight++;
+            }
+            bool exists = live[key];
+            store.getAsync(storeKey(key), [&, exists](const std::string &v) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!v.empty()) found++;
+                if (!v.empty() != exists) wrong++;
+                inflight--;
+                cv.notify_one();
+            });
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return inflight == 0; });
+        std::cout << "found " << found << " of " << config.num << ", "
+                  << wrong << " wrong at queue depth " << depth << std::endl;
+    }
+
+    // n random puts split over threads writers
+    void fillThreads(uint64_t threads) {
+        std::vector<std::vector<uint64_t>> keys(threads);
+        std::vector<std::thread> writers;
+        for (uint64_t t = 0; t < threads; t++)
+            writers.emplace_back([this, t, threads, &keys] {
+                std::mt19937_64 r(301 + t);
+                for (uint64_t i = t; i < config.num; i += threads) {
+                    uint64_t key = r() % config.num;
+                    api().put(storeKey(key), value(key));
+                    keys[t].push_back(key);
+                }
+            });
+        for (auto &w : writers) w.join();
+        for (auto &k : keys)
+            for (uint64_t key : k) live[key] = true;
+    }
+
+    // n random gets split over threads readers, returns the wrong ones
+    uint64_t readThreads(uint64_t threads) {
+        std::vector<uint64_t> wrong(threads, 0);
+        std::vector<std::thread> readers;
+        for (uint64_t t = 0; t < threads; t++)
+            readers.emplace_back([this, t, threads, &wrong] {
+                std::mt19937_64 r(907 + t);
+                for (uint64_t i = t; i < config.num; i += threads) {
+                    uint64_t key = r() % config.num;
+                    bool exists = api().get(storeKey(key)) != "";
+                    if (exists != live[key]) wrong[t]++;
+                }
+            });
+        for (auto &r : readers) r.join();
+        return std::accumulate(wrong.begin(), wrong.end(), (uint64_t)0);
+    }
+
+    static const std::map<std::string, Workload> &workloads() {
+        static const std::map<std::string, Workload> w = {
+            {"fillseq",
+             [](Bench &b) {
+                 for (uint64_t i = 0; i < b.config.num; i++) {
+                     b.api().put(b.storeKey(i), b.value(i));
+                     b.live[i] = true;
+                 }
+                 return b.config.num;
+             }},
+            {"fillrandom",
+             [](Bench &b) {
+                 for (uint64_t i = 0; i < b.config.num; i++) {
+                     uint64_t key = b.randomKey();
+                     b.api().put(b.storeKey(key), b.value(key));
+                     b.live[key] = true;
+                 }
+                 return b.config.num;
+             }},
+            {"fillttl",
+             [](Bench &b) {
+                 // the keys count as deleted, reads must wait for them to
+                 // expire with waitttl
+                 for (uint64_t i = 0; i < b.config.num; i++) {
+                     uint64_t key = b.randomKey();
+                     if (b.sharded)
+                         b.sharded->put(b.storeKey(key), b.value(key),
+                                        b.config.ttl);
+                     else
+                         b.store.put(b.storeKey(key), b.value(key),
+                                     b.config.ttl);
+                     b.live[key] = false;
+                 }
+                 return b.config.num;
+             }},
+            {"waitttl",
+             [](Bench &b) {
+                 std::this_thread::sleep_for(
+                     std::chrono::seconds(b.config.ttl + 1));
+                 return (uint64_t)1;
+             }},
+            {"persistence",
+             [](Bench &b) {
+                 // the writes of the persistence test, value i + 1 bytes
+                 // long for key i, and the longest of them
+                 std::vector<double> latencies;
+                 auto timed = [&](uint64_t key, bool del, char c) {
+                     auto start = std::chrono::steady_clock::now();
+                     if (del)
+                         b.api().del(b.storeKey(key));
+                     else
+                         b.api().put(b.storeKey(key), std::string(key + 1, c));
+                     std::chrono::duration<double> d =
+                         std::chrono::steady_clock::now() - start;
+                     latencies.push_back(d.count());
+                     b.live[key] = !del;
+                 };
+                 for (uint64_t i = 0; i < b.config.num; i++)
+                     timed(i, false, 's');
+                 for (uint64_t i = 0; i < b.config.num; i += 2)
+                     timed(i, true, 0);
+                 for (uint64_t i = 0; i < b.config.num; i++)
+                     if ((i & 3) < 2) timed(i, false, 't');
+                 std::sort(latencies.begin(), latencies.end());
+                 std::cout << "longest write " << latencies.back() * 1e3
+                           << " ms, p99.9 "
+                           << latencies[latencies.size() * 999 / 1000] * 1e3
+                           << " ms, p99 "
+                           << latencies[latencies.size() * 99 / 100] * 1e3
+                           << " ms" << std::endl;
+                 return (uint64_t)latencies.size();
+             }},
+            {"readrandom",
+             [](Bench &b) {
+                 uint64_t found = 0, wrong = 0;
+                 for (uint64_t i = 0; i < b.config.num; i++) {
+                     uint64_t key = b.readKey();
+                     bool exists = b.api().get(b.storeKey(key)) != "";
+                     if (exists) found++;
+                     if (exists != b.live[key]) wrong++;
+                 }
+                 std::cout << "found " << found << " of " << b.config.num
+                           << ", " << wrong << " wrong" << std::endl;
+                 return b.config.num;
+             }},
+            {"fillfixed",
+             [](Bench &b) {
+                 for (uint64_t i = 0; i < b.config.num; i++) {
+                     uint64_t key = b.randomKey();
+                     b.fixed().put(b.storeKey(key), b.fixedValue(key));
+                     b.live[key] = true;
+                 }
+                 return b.config.num;
+             }},
+            {"readfixed",
+             [](Bench &b) {
+                 uint64_t found = 0, wrong = 0;
+                 for (uint64_t i = 0; i < b.config.num; i++) {
+                     uint64_t key = b.readKey();
+                     FixedValue v;
+                     bool exists = b.fixed().get(b.storeKey(key), &v);
+                     if (exists) found++;
+                     if (exists != b.live[key] ||
+                         (exists && v != b.fixedValue(key)))
+                         wrong++;
+                 }
+                 std::cout << "found " << found << " of " << b.config.num
+                           << ", " << wrong << " wrong, "
+                           << b.fixed().sizeOnDisk() << " bytes on disk"
+                           << std::endl;
+                 return b.config.num;
+             }},
+            {"readasync",
+             [](Bench &b) {
+                 for (uint64_t depth : b.config.queueDepths) {
+                     if (b.config.dropCache) dropPageCache();
+                     auto start = std::chrono::steady_clock::now();
+                     b.readAsync(depth);
+                     std::chrono::duration<double> elapsed =
+                         std::chrono::steady_clock::now() - start;
+                     std::cout << "  depth " << depth << ":\t"
+                               << (uint64_t)(b.config.num / elapsed.count())
+                               << " ops/s" << std::endl;
+                 }
+                 return b.config.num * b.config.queueDepths.size();
+             }},
+            {"fillthreads",
+             [](Bench &b) {
+                 for (uint64_t threads : b.config.threads) {
+                     auto start = std::chrono::steady_clock::now();
+                     b.fillThreads(threads);
+                     std::chrono::duration<double> elapsed =
+                         std::chrono::steady_clock::now() - start;
+                     std::cout << "  " << threads << " threads:\t"
+                               << (uint64_t)(b.config.num / elapsed.count())
+                               << " puts/s" << std::endl;
+                 }
+                 return b.config.num * b.config.threads.size();
+             }},
+            {"readthreads",
+             [](Bench &b) {
+                 for (uint64_t threads : b.config.threads) {
+                     // only put and del of a KVStore are thread-safe
+                     if (!b.sharded && threads > 1) {
+                         std::cout << "  readthreads needs --shards"
+                                   << std::endl;
+                         continue;
+                     }
+                     auto start = std::chrono::steady_clock::now();
+                     uint64_t wrong = b.readThreads(threads);
+                     std::chrono::duration<double> elapsed =
+                         std::chrono::steady_clock::now() - start;
+                     std::cout << "  " << threads << " threads:\t"
+                               << (uint64_t)(b.config.num / elapsed.count())
+                               << " gets/s, " << wrong << " wrong"
+                               << std::endl;
+                 }
+                 return b.config.num * b.config.threads.size();
+             }},
+            {"ingest",
+             [](Bench &b) {
+                 // builds tables of random keys out of the store
+                 SstWriter writer(b.config.dir + "/ingest", b.config.options,
+                                  b.config.sortMemory);
+                 for (uint64_t i = 0; i < b.config.num; i++) {
+                     uint64_t key = b.randomKey();
+                     writer.add(b.storeKey(key), b.value(key));
+                     b.live[key] = true;
+                 }
+                 std::vector<std::string> paths = writer.finish();
+                 if (!b.store.ingestFiles(paths))
+                     std::cout << "ingestion failed" << std::endl;
+                 std::cout << "ingested " << paths.size() << " tables"
+                           << std::endl;
+                 return b.config.num;
+             }},
+            {"checkpoint",
+             [](Bench &b) {
+                 std::string dir = b.config.dir + "-checkpoint";
+                 std::filesystem::remove_all(dir);
+                 // a writer rewrites live keys meanwhile, the longest of its
+                 // puts is the stall
+                 std::vector<uint64_t> keys;
+                 for (uint64_t k = 0; k < b.config.num; k++)
+                     if (b.live[k]) keys.push_back(k);
+                 std::atomic<bool> stop(false);
+                 double stall = 0;
+                 std::thread writer([&] {
+                     std::mt19937_64 r(17);
+                     while (!stop && !keys.empty()) {
+                         uint64_t key = keys[r() % keys.size()];
+                         auto start = std::chrono::steady_clock::now();
+                         b.store.put(b.storeKey(key), b.value(key));
+                         std::chrono::duration<double> d =
+                             std::chrono::steady_clock::now() - start;
+                         stall = std::max(stall, d.count());
+                     }
+                 });
+                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                 auto start = std::chrono::steady_clock::now();
+                 bool ok = b.store.createCheckpoint(dir);
+                 std::chrono::duration<double> elapsed =
+                     std::chrono::steady_clock::now() - start;
+                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                 stop = true;
+                 writer.join();
+                 std::cout << "checkpoint " << (ok ? "taken" : "failed")
+                           << " in " << elapsed.count() * 1e3
+                           << " ms, longest put " << stall * 1e3 << " ms"
+                           << std::endl;
+                 // the checkpoint holds every live key
+                 KVStore copy(dir, b.config.options);
+                 uint64_t wrong = 0;
+                 for (uint64_t k = 0; k < b.config.num; k++)
+                     if ((copy.get(b.storeKey(k)) != "") != b.live[k]) wrong++;
+                 std::cout << "checkpoint has " << wrong << " wrong keys"
+                           << std::endl;
+                 return (uint64_t)1;
+             }},
+            {"deleterange",
+             [](Bench &b) {
+                 // ranges of scan width, about a tenth of the keys in all
+                 uint64_t ranges =
+                     std::max((uint64_t)1, b.config.num / 10 /
+                                               b.config.scanWidth);
+                 for (uint64_t i = 0; i < ranges; i++) {
+                     uint64_t start = b.randomKey();
+                     uint64_t end = std::min(b.config.num - 1,
+                                             start + b.config.scanWidth - 1);
+                     b.store.deleteRange(start, end);
+                     for (uint64_t k = start; k <= end; k++) b.live[k] = false;
+                 }
+                 return ranges;
+             }},
+            {"reset",
+             [](Bench &b) {
+                 b.store.reset();
+                 b.live.assign(b.config.num, false);
+                 return (uint64_t)1;
+             }},
+            {"resetasync",
+             [](Bench &b) {
+                 b.store.resetAsync();
+                 b.live.assign(b.config.num, false);
+                 return (uint64_t)1;
+             }},
+            {"dropcache",
+             [](Bench &b) {
+                 dropPageCache();
+                 return (uint64_t)1;
+             }},
+            {"readpinned",
+             [](Bench &b) {
+                 uint64_t found = 0, wrong = 0;
+                 b.pinned.clear();
+                 for (uint64_t i = 0; i < b.config.num; i++) {
+                     uint64_t key = b.randomKey();
+                     PinnedValue v = b.store.getPinned(b.storeKey(key));
+                     if (!v.empty()) found++;
+                     if (!v.empty() != b.live[key]) wrong++;
+                     if (!v.empty() && b.pinned.size() < 1000)
+                         b.pinned.push_back({key, v});
+                 }
+                 std::cout << "found " << found << " of " << b.config.num
+                           << ", " << wrong << " wrong" << std::endl;
+                 return b.config.num;
+             }},
+            {"checkpinned",
+             [](Bench &b) {
+                 // the tables may have been compacted away since
+                 uint64_t wrong = 0;
+                 for (auto &p : b.pinned)
+                     if (p.second.toString() != b.value(p.first)) wrong++;
+                 std::cout << b.pinned.size() << " pinned values, " << wrong
+                           << " wrong" << std::endl;
+                 uint64_t n = b.pinned.size();
+                 b.pinned.clear();
+                 return n;
+             }},
+            {"deleterandom",
+             [](Bench &b) {
+                 for (uint64_t i = 0; i < b.config.num; i++) {
+                     uint64_t key = b.randomKey();
+                     b.api().del(b.storeKey(key));
+                     b.live[key] = false;
+                 }
+                 return b.config.num;
+             }},
+            {"scanrandom",
+             [](Bench &b) {
+                 uint64_t scans = std::max((uint64_t)1, b.config.num / 10);
+                 uint64_t found = 0, wrong = 0;
+                 for (uint64_t i = 0; i < scans; i++) {
+                     uint64_t start = b.config.sparse ? b.rng() : b.randomKey();
+                     uint64_t end = start + b.config.scanWidth - 1;
+                     if (end < start) end = UINT64_MAX;
+                     std::list<std::pair<uint64_t, std::string>> list;
+                     b.api().scan(start, end, list);
+                     found += list.size();
+                     // dense keys are checked against the live keys
+                     if (b.config.sparse) continue;
+                     uint64_t expected = 0;
+                     for (uint64_t k = start; k <= end && k < b.config.num; k++)
+                         if (b.live[k]) expected++;
+                     if (list.size() != expected) wrong++;
+                 }
+                 std::cout << "found " << found << " entries in " << scans
+                           << " scans of " << b.config.scanWidth << " keys, "
+                           << wrong << " wrong" << std::endl;
+                 return scans;
+             }},
+            {"vloggc",
+             [](Bench &b) {
+                 // one pass over the files sealed so far, live values are
+                 // rewritten to new files which are left alone
+                 uint64_t sealed = b.store.getStats().valueLogBytes /
+                                   b.config.options.valueLogFileSize;
+                 uint64_t files = 0;
+                 uint64_t before = b.store.sizeOnDisk();
+                 while (files < sealed && b.store.garbageCollectValueLog())
+                     files++;
+                 std::cout << "reclaimed " << files << " files, "
+                           << before - b.store.sizeOnDisk() << " bytes"
+                           << std::endl;
+                 return files;
+             }},
+        };
+        return w;
+    }
+};
+
+void usage(const char *prog) {
+    std::cout << "Usage: " << prog << " workload[,workload...] [-n num]"
+              << " [-v value size] [-d dir] [--multiplier n]"
+              << " [--l0-trigger n] [--style leveled|tiered]"
+              << " [--subcompactions n] [--direct 0|1] [--sync 0|1]"
+              << " [--rate-limit bytes/s] [--vlog-threshold bytes]"
+              << " [--vlog-file-size bytes] [--learned-index error]"
+              << " [--index-cache bytes] [--pinned-levels n]"
+              << " [--memtable-hash 0|1] [--range-filter bits]"
+              << " [--sparse 0|1] [--scan-width n]"
+              << " [--queue-depth n[,n...]] [--io-threads n] [--drop-cache 0|1]"
+              << " [--threads n[,n...]] [--wal 0|1] [--sync-writes 0|1]"
+              << " [--shards n] [--sort-memory bytes]"
+              << " [--incremental ratio] [--row-cache bytes] [--zipf theta]"
+              << " [--compact 0|1] [--memtable-bytes bytes]"
+              << " [--table-bytes bytes] [--immutable-memtables n]"
+              << " [--write-buffer bytes] [--pipelined-flush 0|1]"
+              << " [--ttl seconds]" << std::endl;
+    std::cout << "  workloads: fillseq fillrandom readrandom deleterandom"
+              << " fillthreads readthreads scanrandom readasync readpinned"
+              << " checkpinned vloggc deleterange reset resetasync ingest"
+              << " checkpoint persistence fillfixed readfixed"
+              << " fillttl waitttl dropcache"
+              << std::endl;
+}
+
+// a comma separated list of numbers
+std::vector<uint64_t> parseList(const std::string &s) {
+    std::vector<uint64_t> list;
+    std::stringstream items(s);
+    std::string item;
+    while (std::getline(items, item, ',')) list.push_back(std::stoull(item));
+    return list;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    BenchConfig config;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string flag(argv[i]);
+        uint64_t value = std::strtoull(argv[i + 1], nullptr, 10);
+        if (flag == "-n")
+            config.num = value;
+        else if (flag == "-v")
+            config.valueSize = value;
+        else if (flag == "-d")
+            config.dir = argv[i + 1];
+        else if (flag == "--multiplier")
+            config.options.levelMultiplier = value;
+        else if (flag == "--subcompactions")
+            config.options.maxSubcompactions = value;
+        else if (flag == "--direct")
+            config.options.directIOForCompaction = value;
+        else if (flag == "--sync")
+            config.options.syncTables = value;
+        else if (flag == "--rate-limit")
+            config.options.compactionRateLimit = value;
+        else if (flag == "--vlog-threshold")
+            config.options.valueLogThreshold = value;
+        else if (flag == "--vlog-file-size")
+            config.options.valueLogFileSize = value;
+        else if (flag == "--queue-depth")
+            config.queueDepths = parseList(argv[i + 1]);
+        else if (flag == "--threads")
+            config.threads = parseList(argv[i + 1]);
+        else if (flag == "--sort-memory")
+            config.sortMemory = value;
+        else if (flag == "--ttl")
+            config.ttl = value;
+        else if (flag == "--compact")
+            config.options.compactTables = value;
+        else if (flag == "--memtable-bytes")
+            config.options.memTableBytes = value;
+        else if (flag == "--table-bytes")
+            config.options.tableBytes = value;
+        else if (flag == "--immutable-memtables")
+            config.options.maxImmutableMemTables = value;
+        else if (flag == "--pipelined-flush")
+            config.options.pipelinedFlush = value;
+        else if (flag == "--write-buffer")
+            config.options.writeBufferManager =
+                std::make_shared<WriteBufferManager>(value);
+        else if (flag == "--row-cache")
+            config.options.rowCacheBytes = value;
+        else if (flag == "--zipf")
+            config.zipf = std::stod(argv[i + 1]);
+        else if (flag == "--incremental")
+            config.options.incrementalCompactionRatio = value;
+        else if (flag == "--shards")
+            config.shards = value;
+        else if (flag == "--wal")
+            config.options.writeAheadLog = value;
+        else if (flag == "--sync-writes")
+            config.options.syncWrites = value;
+        else if (flag == "--drop-cache")
+            config.dropCache = value;
+        else if (flag == "--io-threads")
+            config.options.ioThreads = value;
+        else if (flag == "--sparse")
+            config.sparse = value;
+        else if (flag == "--scan-width")
+            config.scanWidth = value;
+        else if (flag == "--range-filter")
+            config.options.rangeFilterBitsPerKey = value;
+        else if (flag == "--memtable-hash")
+            config.options.memTableHashIndex = value;
+        else if (flag == "--index-cache")
+            config.options.indexCacheBytes = value;
+        else if (flag == "--pinned-levels")
+            config.options.pinnedIndexLevels = value;
+        else if (flag == "--learned-index")
+            config.options.learnedIndexError = value;
+        else if (flag == "--l0-trigger")
+            config.options.l0CompactionTrigger = value;
+        else if (flag == "--style" && std::string(argv[i + 1]) == "tiered")
+            config.options.compactionStyle = CompactionStyle::Tiered;
+        else if (flag == "--style" && std::string(argv[i + 1]) == "leveled")
+            config.options.compactionStyle = CompactionStyle::Leveled;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    Bench bench(config);
+    std::stringstream workloads(argv[1]);
+    std::string name;
+    while (std::getline(workloads, name, ',')) bench.run(name);
+    bench.report();
+    return 0;
+}
@@ -1,20 +1,171 @@
 #pragma once
+#include <cstring>
 #include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "index_search.h"
+#include "learned_index.h"
+#include "range_filter.h"
+#include "varint.h"
+
+// set in the length field of an entry whose value is a ValuePointer into the
+// value log (see value_log.h) instead of the value itself
+const uint64_t VALUE_POINTER = 1ULL << 63;
+
+// set in the time field of an entry put with a ttl, whose value starts with
+// the time it expires at in 8 bytes, seconds since the epoch
+const uint64_t EXPIRING = 1ULL << 62;
+
+// Takes the expiry off an entry read with the given time field and value:
+// clears the flag in time, moves val past the expiry and returns the time
+// it expires at, 0 if the entry doesn't expire.
+inline int64_t takeExpiry(int64_t &time, const char *&val, uint64_t &len) {
+    if (!((uint64_t)time & EXPIRING)) return 0;
+    time = (int64_t)((uint64_t)time & ~EXPIRING);
+    int64_t expiresAt = 0;
+    if (len < sizeof(expiresAt)) return 0;
+    memcpy(&expiresAt, val, sizeof(expiresAt));
+    val += sizeof(expiresAt);
+    len -= sizeof(expiresAt);
+    return expiresAt;
+}
+
+// whether an entry that expires at expiresAt, 0 for never, is gone at now
+inline bool expired(int64_t expiresAt, int64_t now) {
+    return expiresAt > 0 && expiresAt <= now;
+}
+
+// Entries of a compact table start with three varints instead of the fixed
+// key, time and length: the key less the key of the previous entry, the
+// time field, and the length shifted left by one with the low bit set for a
+// ValuePointer.
+inline void putCompactHeader(std::string &dst, uint64_t keyDelta,
+                             int64_t time, uint64_t len, bool indirect) {
+    putVarint(dst, keyDelta);
+    putVarint(dst, (uint64_t)time);
+    putVarint(dst, len << 1 | indirect);
+}
+
+// parses the header of a compact entry at p and returns where its value
+// starts, nullptr if the header or the value passes end
+inline const char *parseCompactHeader(const char *p, const char *end,
+                                      uint64_t &keyDelta, int64_t &time,
+                                      uint64_t &len, bool &indirect) {
+    uint64_t t = 0;
+    if (!(p = getVarint(p, end, keyDelta)) || !(p = getVarint(p, end, t)) ||
+        !(p = getVarint(p, end, len)))
+        return nullptr;
+    time = (int64_t)t;
+    indirect = len & 1;
+    len >>= 1;
+    if ((uint64_t)(end - p) < len) return nullptr;
+    return p;
+}
 
 struct Pair {
     uint64_t key;
     int64_t time;
     std::string val;
+    bool indirect = false;  // val is an encoded ValuePointer
+    int64_t expiresAt = 0;  // 0 if the entry doesn't expire
     Pair(uint64_t key, std::string val) : key(key), val(val) {}
-    Pair(uint64_t key, int64_t time, std::string val)
-        : key(key), time(time), val(val) {}
+    Pair(uint64_t key, int64_t time, std::string val, bool indirect = false,
+         int64_t expiresAt = 0)
+        : key(key),
+          time(time),
+          val(val),
+          indirect(indirect),
+          expiresAt(expiresAt) {}
 };
 
-struct Index {
-    uint64_t key;
-    uint64_t offset;
-    Index(uint64_t key, uint64_t offset) : key(key), offset(offset) {}
+// index tables are paged in blocks of this many entries, 4 KiB on disk
+const uint64_t INDEX_BLOCK_ENTRIES = 256;
+
+// Statistics of an ss-table written after its footer, read when the table
+// is loaded without scanning its data. Tables written before the block
+// existed have none.
+struct TableProperties {
+    bool present = false;  // whether the table has a properties block
+    uint64_t entries = 0;
+    uint64_t tombstones = 0;  // entries with an empty value
+    uint64_t minKey = 0;
+    uint64_t maxKey = 0;
+    uint64_t rawBytes = 0;    // the keys and values as they were added
+    uint64_t dataBytes = 0;   // the data segment they are encoded in
+    uint64_t indexBytes = 0;  // the index table, model and footer
+    int64_t minTime = 0;      // the times the entries are stamped with
+    int64_t maxTime = 0;
+    int64_t createdAt = 0;    // when the table was written
+    // orders the table against range tombstones, 0 in tables written before
+    // tables had one (see KVStore)
+    int64_t sequence = 0;
+
+    // the fraction of the entries that are deletions
+    double tombstoneRatio() const {
+        return entries ? (double)tombstones / entries : 0;
+    }
+};
+
+// The cached part of an ss-table: its index table and the size of the file.
+// Keys and offsets are separate arrays so a search only reads keys. A table
+// may release them, lookups then read the few index entries its model points
+// at, or the index block its fences point at, from the file.
+struct IndexTable {
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> offsets;  // of the entry of each key
+    std::vector<uint64_t> fences;   // the first key of each index block
+    uint64_t number = 0;  // identifies the table in the index cache
+    uint64_t entries;
+    uint64_t first;  // the smallest key
+    uint64_t last;   // the largest key
+    uint64_t indexOffset;  // where the data segment ends and the index starts
+    uint64_t size;
+    // where the footer ends, the properties block follows if there is one
+    uint64_t footerEnd;
+    TableProperties properties;
+    // written with delta keys and varint headers, see TableBuilder
+    bool compact = false;
+    LinearModel model;  // empty if the table has none
+    RangeFilter filter;  // empty if the table has none
+    IndexTable(std::vector<uint64_t> keys, std::vector<uint64_t> offsets,
+               uint64_t indexOffset, uint64_t size,
+               LinearModel model = LinearModel())
+        : keys(std::move(keys)),
+          offsets(std::move(offsets)),
+          entries(this->keys.size()),
+          first(entries ? this->keys.front() : 0),
+          last(entries ? this->keys.back() : 0),
+          indexOffset(indexOffset),
+          size(size),
+          footerEnd(size),
+          model(std::move(model)) {
+        for (uint64_t i = 0; i < entries; i += INDEX_BLOCK_ENTRIES)
+            fences.push_back(this->keys[i]);
+    }
+    bool empty() const { return entries == 0; }
+    uint64_t minKey() const { return first; }
+    uint64_t maxKey() const { return last; }
+    uint64_t dataEnd() const { return indexOffset; }
+    // whether keys and offsets are in memory
+    bool resident() const { return keys.size() == entries; }
+    // drops keys and offsets
+    void release() {
+        std::vector<uint64_t>().swap(keys);
+        std::vector<uint64_t>().swap(offsets);
+    }
+    // the bytes taken in memory by the index, the fences, the model and the
+    // filter
+    uint64_t memoryBytes() const {
+        return (keys.capacity() + offsets.capacity() + fences.capacity()) * 8 +
+               model.bytes() + filter.bytes();
+    }
+    // the position of key in the table, -1 if it doesn't exist, the table
+    // must be resident
+    int find(uint64_t key) const {
+        return searchKeys(keys.data(), keys.size(), key);
+    }
 };
 
 struct Location {
@@ -31,3 +182,56 @@ struct Entry {
     Entry(uint64_t key, time_t timestamp, uint64_t len, std::string str)
         : key(key), timestamp(timestamp), len(len), str(str) {}
 };
+
+// Counters of the work done by a KVStore, all sizes are in bytes
+struct Stats {
+    uint64_t userBytes = 0;  // keys and values passed to put
+    uint64_t flushBytes = 0;  // ss-tables written by memTable conversion
+    uint64_t flushMicros = 0;  // time spent writing them
+    uint64_t ingestBytes = 0;  // ss-tables moved in by ingestFiles
+    uint64_t flushStalls = 0;  // writes waiting for a background flush
+    uint64_t valueLogBytes = 0;  // values appended to the value log
+    uint64_t compactionBytesRead = 0;
+    uint64_t compactionBytesWritten = 0;
+    uint64_t compactions = 0;
+    uint64_t trivialMoves = 0;
+    uint64_t compactionMicros = 0;  // wall time spent in compaction
+    uint64_t rowCacheHits = 0;  // gets found in the row cache
+    uint64_t gets = 0;  // gets that miss the memTable and the row cache
+    uint64_t tableProbes = 0;  // index tables searched by those gets
+    uint64_t indexCacheHits = 0;  // index blocks of released tables found
+    uint64_t indexCacheMisses = 0;  // and read from the file
+    uint64_t filterSkips = 0;  // tables skipped by their range filter
+    uint64_t scanTableReads = 0;  // tables read by scans
+    uint64_t expiredEntries = 0;  // expired entries compaction deleted
+
+    Stats &operator+=(const Stats &s) {
+        userBytes += s.userBytes;
+        flushBytes += s.flushBytes;
+        flushMicros += s.flushMicros;
+        ingestBytes += s.ingestBytes;
+        flushStalls += s.flushStalls;
+        valueLogBytes += s.valueLogBytes;
+        compactionBytesRead += s.compactionBytesRead;
+        compactionBytesWritten += s.compactionBytesWritten;
+        compactions += s.compactions;
+        trivialMoves += s.trivialMoves;
+        compactionMicros += s.compactionMicros;
+        rowCacheHits += s.rowCacheHits;
+        gets += s.gets;
+        tableProbes += s.tableProbes;
+        indexCacheHits += s.indexCacheHits;
+        indexCacheMisses += s.indexCacheMisses;
+        filterSkips += s.filterSkips;
+        scanTableReads += s.scanTableReads;
+        expiredEntries += s.expiredEntries;
+        return *this;
+    }
+
+    // bytes written to disk per byte written by the user
+    double writeAmplification() const {
+        if (userBytes == 0) return 0;
+        return (double)(flushBytes + valueLogBytes + compactionBytesWritten) /
+               userBytes;
+    }
+};
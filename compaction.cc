@@ -0,0 +1,184 @@
+#include "compaction.h"
+
+#include <algorithm>
+
+std::unique_ptr<CompactionPolicy> newCompactionPolicy(const Options &options) {
+    if (options.compactionStyle == CompactionStyle::Tiered)
+        return std::unique_ptr<CompactionPolicy>(new TieredCompaction(options));
+    return std::unique_ptr<CompactionPolicy>(new LeveledCompaction(options));
+}
+
+uint64_t levelBytes(const LevelView &levels, int level) {
+    uint64_t bytes = 0;
+    if ((int)levels.size() <= level) return 0;
+    for (auto t : levels[level]) bytes += t->size;
+    return bytes;
+}
+
+double compensatedSize(const IndexTable &table) {
+    return table.size * (1 + 2 * table.properties.tombstoneRatio());
+}
+
+void overlappingTables(const LevelView &levels, int level, uint64_t min,
+                       uint64_t max, int &first, int &last) {
+    first = 0;
+    last = 0;
+    if ((int)levels.size() <= level) return;
+    const std::vector<const IndexTable *> &tables = levels[level];
+    while (first < (int)tables.size() && tables[first]->maxKey() < min)
+        first++;
+    last = first;
+    while (last < (int)tables.size() && tables[last]->minKey() <= max) last++;
+}
+
+uint64_t LeveledCompaction::levelTargetBytes(int level) const {
+    uint64_t target = options.levelBaseBytes;
+    for (int i = 1; i < level; i++) target *= options.levelMultiplier;
+    return target;
+}
+
+double LeveledCompaction::compactionScore(const LevelView &levels,
+                                          int level) const {
+    if (level == 0)
+        return (double)levels[0].size() / options.l0CompactionTrigger;
+    if ((int)levels.size() <= level) return 0;
+    double bytes = 0;
+    for (auto t : levels[level]) bytes += compensatedSize(*t);
+    return bytes / levelTargetBytes(level);
+}
+
+int LeveledCompaction::pickCompactionFile(const LevelView &levels,
+                                          int level) {
+    const std::vector<const IndexTable *> &tables = levels[level];
+    int n = tables.size();
+    if ((int)compactPointer.size() <= level) compactPointer.resize(level + 1);
+    // starts from the first table after the one picked last time
+    int start = 0;
+    if (compactPointer[level] != 0) {
+        while (start < n && tables[start]->minKey() <= compactPointer[level])
+            start++;
+        if (start == n) start = 0;
+    }
+    int picked = start;
+    double minRatio = -1;
+    for (int k = 0; k < n; k++) {
+        int i = (start + k) % n;
+        int first = 0, last = 0;
+        overlappingTables(levels, level + 1, tables[i]->minKey(),
+                          tables[i]->maxKey(), first, last);
+        uint64_t overlap = 0;
+        for (int j = first; j < last; j++)
+            overlap += levels[level + 1][j]->size;
+        double ratio = overlap / compensatedSize(*tables[i]);
+        if (minRatio < 0 || ratio < minRatio) {
+            minRatio = ratio;
+            picked = i;
+        }
+    }
+    compactPointer[level] = tables[picked]->maxKey();
+    return picked;
+}
+
+bool LeveledCompaction::pick(const LevelView &levels, CompactionTask &task) {
+    // looks for the level with the highest score
+    int level = -1;
+    double maxScore = 1;
+    for (int lv = 0; lv < (int)levels.size(); lv++) {
+        double score = compactionScore(levels, lv);
+        if (score >= maxScore) {
+            maxScore = score;
+            level = lv;
+        }
+    }
+    if (level == -1) return false;
+
+    task.inputs.clear();
+    task.outputLevel = level + 1;
+    if (level == 0) {
+        // tables in level 0 overlap each other, they are merged together
+        for (size_t i = 0; i < levels[0].size(); i++)
+            task.inputs.push_back(Location(0, i));
+    } else {
+        int id = pickCompactionFile(levels, level);
+        task.inputs.push_back(Location(level, id));
+    }
+    // range statistics
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    for (auto &l : task.inputs) {
+        min = std::min(min, levels[l.level][l.id]->minKey());
+        max = std::max(max, levels[l.level][l.id]->maxKey());
+    }
+    // the overlapped tables in the next level are merged as well
+    int first = 0, last = 0;
+    overlappingTables(levels, task.outputLevel, min, max, first, last);
+    for (int i = first; i < last; i++)
+        task.inputs.push_back(Location(task.outputLevel, i));
+    return true;
+}
+
+bool TieredCompaction::pick(const LevelView &levels, CompactionTask &task) {
+    // lists the runs from the newest to the oldest
+    std::vector<Run> runs;
+    size_t l0Runs = levels.empty() ? 0 : levels[0].size();
+    for (size_t i = 0; i < l0Runs; i++)
+        runs.push_back(Run{0, (int)i, levels[0][i]->size});
+    for (int lv = 1; lv < (int)levels.size(); lv++)
+        if (!levels[lv].empty())
+            runs.push_back(Run{lv, -1, levelBytes(levels, lv)});
+    if (runs.size() < 2 || (int)runs.size() < options.tieredRunTrigger)
+        return false;
+
+    size_t picked = 0;
+    // space amplification: the runs besides the oldest one are garbage in the
+    // worst case
+    uint64_t total = 0;
+    for (auto &r : runs) total += r.size;
+    const Run &oldest = runs.back();
+    if (oldest.level > 0 && (total - oldest.size) * 100 >
+                                options.tieredMaxSpaceAmplification *
+                                    oldest.size) {
+        picked = runs.size();
+    } else {
+        // takes the runs in level 0 together, and then the following runs as
+        // long as each of them is not larger than the runs picked so far
+        picked = std::max(l0Runs, (size_t)1);
+        uint64_t size = 0;
+        for (size_t i = 0; i < picked; i++) size += runs[i].size;
+        while (picked < runs.size() &&
+               runs[picked].size * 100 <=
+                   size * (100 + options.tieredSizeRatio)) {
+            size += runs[picked].size;
+            picked++;
+        }
+        // no similar sized runs, merges the newest ones to bring the number
+        // of runs below the trigger
+        if (picked < 2)
+            picked = std::max(
+                (size_t)2, runs.size() - options.tieredRunTrigger + 2);
+    }
+
+    // the output goes to the level of the oldest picked run, or the deepest
+    // free level above all older runs if only tables of level 0 are picked
+    int outputLevel = runs[picked - 1].level;
+    if (outputLevel == 0) {
+        outputLevel = options.tieredNumLevels - 1;
+        if (picked < runs.size()) outputLevel = runs[picked].level - 1;
+        if (outputLevel < 1) {
+            picked++;
+            outputLevel = runs[picked - 1].level;
+        }
+    }
+
+    task.inputs.clear();
+    task.outputLevel = outputLevel;
+    for (size_t i = 0; i < picked; i++) {
+        if (runs[i].level == 0) {
+            task.inputs.push_back(Location(0, runs[i].id));
+            continue;
+        }
+        for (size_t j = 0; j < levels[runs[i].level].size(); j++)
+            task.inputs.push_back(Location(runs[i].level, j));
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "common.h"
+#include "options.h"
+
+// Tables of a store level by level, tables of level 0 from the newest to the
+// oldest and tables of other levels sorted by key
+typedef std::vector<std::vector<const IndexTable *>> LevelView;
+
+// A compaction picked by a policy. The input tables are merged and written to
+// outputLevel, tables of outputLevel that are not inputs must not overlap the
+// key range of the inputs.
+struct CompactionTask {
+    std::vector<Location> inputs;  // from the newest table to the oldest
+    int outputLevel;
+};
+
+// Decides which tables to merge, KVStore::compaction carries the task out
+class CompactionPolicy {
+   public:
+    virtual ~CompactionPolicy() {}
+
+    // picks the next compaction, returns false if the store needs none
+    virtual bool pick(const LevelView &levels, CompactionTask &task) = 0;
+};
+
+// creates the policy selected by options.compactionStyle
+std::unique_ptr<CompactionPolicy> newCompactionPolicy(const Options &options);
+
+// Each level n > 0 is a single sorted run of levelBaseBytes *
+// levelMultiplier ^ (n - 1) bytes. The level with the highest score is
+// compacted into the next one, see README.md.
+class LeveledCompaction : public CompactionPolicy {
+   public:
+    LeveledCompaction(const Options &options) : options(options) {}
+
+    bool pick(const LevelView &levels, CompactionTask &task) override;
+
+   private:
+    Options options;
+
+    // the largest key of the last table picked in each level
+    std::vector<uint64_t> compactPointer;
+
+    // the target size in bytes of a level other than level 0
+    uint64_t levelTargetBytes(int level) const;
+
+    // A level needs compaction when its score is at least 1. The score of
+    // level 0 is based on the number of files since they overlap each other
+    // and a get has to probe all of them, the score of other levels is their
+    // compensated size relative to the target.
+    double compactionScore(const LevelView &levels, int level) const;
+
+    // picks the table in level (> 0) whose key range overlaps the least bytes
+    // in the next level for its compensated size, ties are broken
+    // round-robin from compactPointer
+    int pickCompactionFile(const LevelView &levels, int level);
+};
+
+// Size-tiered (universal) compaction. Every table of level 0 and every
+// non-empty level n > 0 is a sorted run, newer runs live in lower levels.
+// When there are tieredRunTrigger runs, the newest runs of similar size
+// are merged into one, or all of them if the runs besides the oldest one take
+// more than tieredMaxSpaceAmplification percent of its size.
+class TieredCompaction : public CompactionPolicy {
+   public:
+    TieredCompaction(const Options &options) : options(options) {}
+
+    bool pick(const LevelView &levels, CompactionTask &task) override;
+
+   private:
+    Options options;
+
+    struct Run {
+        int level;
+        int id;  // the id of the table for a run in level 0, otherwise -1
+        uint64_t size;
+    };
+};
+
+// the total size in bytes of tables in a level
+uint64_t levelBytes(const LevelView &levels, int level);
+
+// The size of a table with its tombstones counted three times, from its
+// properties. Leveled compaction scores levels and picks tables by it, so
+// tables of deletions go down sooner and free the space of the entries
+// they hide.
+double compensatedSize(const IndexTable &table);
+
+// finds the tables in level overlapping [min, max], they are the range
+// [first, last) since tables of a level other than 0 are sorted and disjoint
+void overlappingTables(const LevelView &levels, int level, uint64_t min,
+                       uint64_t max, int &first, int &last);
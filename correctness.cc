@@ -1,7 +1,23 @@
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <cstdint>
 #include <string>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
 
+#include <unistd.h>
+
+#include "fixed_kvstore.h"
+#include "sharded_kvstore.h"
+#include "sst_writer.h"
 #include "test.h"
 
 class CorrectnessTest : public Test {
@@ -9,45 +25,969 @@ private:
 	const uint64_t SIMPLE_TEST_MAX = 512;
 	const uint64_t LARGE_TEST_MAX = 1024 * 64;
 
-	void regular_test(uint64_t max)
+	void regular_test(KVStore &s, uint64_t max)
 	{
 		uint64_t i;
 
 		// Test a single key
-		EXPECT(not_found, store.get(1));
-		store.put(1, "SE");
-		EXPECT("SE", store.get(1));
-		EXPECT(true, store.del(1));
-		EXPECT(not_found, store.get(1));
-		EXPECT(false, store.del(1));
+		EXPECT(not_found, s.get(1));
+		s.put(1, "SE");
+		EXPECT("SE", s.get(1));
+		EXPECT(true, s.del(1));
+		EXPECT(not_found, s.get(1));
+		EXPECT(false, s.del(1));
 
 		phase();
 
 		// Test multiple key-value pairs
 		for (i = 0; i < max; ++i) {
-			store.put(i, std::string(i+1, 's'));
-			EXPECT(std::string(i+1, 's'), store.get(i));
+			s.put(i, std::string(i+1, 's'));
+			EXPECT(std::string(i+1, 's'), s.get(i));
 		}
 		phase();
 
 		// Test after all insertions
 		for (i = 0; i < max; ++i)
-			EXPECT(std::string(i+1, 's'), store.get(i));
+			EXPECT(std::string(i+1, 's'), s.get(i));
 		phase();
 
 		// Test deletions
 		for (i = 0; i < max; i+=2)
-			EXPECT(true, store.del(i));
+			EXPECT(true, s.del(i));
 
 		for (i = 0; i < max; ++i)
 			EXPECT((i & 1) ? std::string(i+1, 's') : not_found,
-			       store.get(i));
+			       s.get(i));
 
 		for (i = 1; i < max; ++i)
-			EXPECT(i & 1, store.del(i));
+			EXPECT(i & 1, s.del(i));
+
+		phase();
+
+		report();
+	}
+
+	const std::string RANGE_DIR = "./data-range";
+
+	// the value of key after the deletions of range_test
+	std::string range_value(uint64_t key)
+	{
+		if (key == 1500)
+			return "after";
+		if (key >= 1000 && key <= 2999)
+			return not_found;
+		return std::string(key % 64 + 1, 'r');
+	}
+
+	void range_check(KVStore &s, uint64_t max)
+	{
+		uint64_t i, live = 0;
+		for (i = 0; i < max; ++i) {
+			EXPECT(range_value(i), s.get(i));
+			live += range_value(i) != not_found;
+		}
+		std::list<std::pair<uint64_t, std::string>> list;
+		s.scan(0, max - 1, list);
+		EXPECT(live, (uint64_t)list.size());
+		for (auto &p : list)
+			EXPECT(range_value(p.first), p.second);
+	}
+
+	void range_test(uint64_t max, Options options = Options())
+	{
+		options.writeAheadLog = true;
+		std::filesystem::remove_all(RANGE_DIR);
+		std::unique_ptr<KVStore> s(new KVStore(RANGE_DIR, options));
+		uint64_t i;
+
+		// Test a range over tables and the memTable, and a put after it
+		for (i = 0; i < max; ++i)
+			s->put(i, std::string(i % 64 + 1, 'r'));
+		s->deleteRange(1000, 2999);
+		s->put(1500, "after");
+		range_check(*s, max);
+		EXPECT(not_found, s->get(2999));
+		EXPECT(std::string(64, 'r'), s->get(3007));
+		phase();
+
+		// Test after compaction has merged the tables below the range
+		for (i = 0; i < 12 * 1024; ++i)
+			s->put(max + i, std::string(1024, 'x'));
+		range_check(*s, max);
+		phase();
+
+		// Test after reopening the store
+		s.reset();
+		s.reset(new KVStore(RANGE_DIR, options));
+		range_check(*s, max);
+		phase();
+
+		// Test resetAsync
+		s->resetAsync();
+		for (i = 0; i < max; i += 64)
+			EXPECT(not_found, s->get(i));
+		for (i = 0; i < 100; ++i)
+			s->put(i, "again");
+		s.reset();
+		s.reset(new KVStore(RANGE_DIR, options));
+		for (i = 0; i < 100; ++i)
+			EXPECT(std::string("again"), s->get(i));
+		for (i = 100; i < max; i += 64)
+			EXPECT(not_found, s->get(i));
+		phase();
+
+		// Test that trash left by a crash is deleted on open
+		s.reset();
+		std::filesystem::path trash =
+			std::filesystem::path(RANGE_DIR) / "trash-9" / "level-0";
+		std::filesystem::create_directories(trash);
+		std::ofstream((trash / "sstable-0").string()) << "left over";
+		// files named only like the store's own are left alone
+		const char *others[] = {"trash-old", "level-", "wal-1.bak"};
+		for (auto name : others)
+			std::ofstream((std::filesystem::path(RANGE_DIR) / name)
+				      .string()) << "other";
+		s.reset(new KVStore(RANGE_DIR, options));
+		for (i = 0; i < 100; ++i)
+			EXPECT(std::string("again"), s->get(i));
+		// the store waits for the trash to go when it closes
+		s.reset();
+		EXPECT(false, std::filesystem::exists(
+				      std::filesystem::path(RANGE_DIR) / "trash-9"));
+		for (auto name : others)
+			EXPECT(true, std::filesystem::exists(
+					     std::filesystem::path(RANGE_DIR) / name));
+		phase();
+
+		std::filesystem::remove_all(RANGE_DIR);
+		report();
+	}
+
+	const std::string COMPACTION_DIR = "./data-compaction";
+
+	// the regular and range deletion phases on a store with options
+	void compaction_test(const Options &options, uint64_t max)
+	{
+		std::filesystem::remove_all(COMPACTION_DIR);
+		std::unique_ptr<KVStore> s(new KVStore(COMPACTION_DIR, options));
+		regular_test(*s, max);
+		s.reset();
+		std::filesystem::remove_all(COMPACTION_DIR);
+		range_test(max, options);
+	}
+
+	const std::string FORMAT_DIR = "./data-format";
+
+	// the value of key after round writes of format_test
+	std::string format_value(uint64_t key, int round)
+	{
+		if (key % 5 == 0)
+			return not_found;
+		for (int r = round; r > 0; --r)
+			if (key % 3 == (uint64_t)r)
+				return std::string(key % 300 + 1, 'a' + r);
+		return std::string(key % 200 + 1, 'f');
+	}
+
+	void format_check(KVStore &s, uint64_t max, int round)
+	{
+		uint64_t i, live = 0;
+		for (i = 0; i < max; ++i) {
+			EXPECT(format_value(i, round), s.get(i));
+			live += format_value(i, round) != not_found;
+		}
+		std::list<std::pair<uint64_t, std::string>> list;
+		s.scan(0, max - 1, list);
+		EXPECT(live, (uint64_t)list.size());
+		for (auto &p : list)
+			EXPECT(format_value(p.first, round), p.second);
+	}
+
+	// writes round of format_test: overwrites a third of the keys and
+	// deletes a fifth of them
+	void format_write(KVStore &s, uint64_t max, int round)
+	{
+		uint64_t i;
+		for (i = 0; i < max; ++i)
+			if (round == 0 || i % 3 == (uint64_t)round)
+				s.put(i, round == 0 ? std::string(i % 200 + 1, 'f')
+						    : format_value(i, round));
+		for (i = 0; i < max; i += 5)
+			s.del(i);
+	}
+
+	// Tables of both formats are read by a store opened with either
+	// compactTables, alone or mixed in a level
+	void format_test(uint64_t max)
+	{
+		for (int first = 0; first < 2; ++first) {
+			Options options;
+			options.writeAheadLog = true;
+			options.compactTables = first;
+			std::filesystem::remove_all(FORMAT_DIR);
+			std::unique_ptr<KVStore> s(new KVStore(FORMAT_DIR, options));
+			format_write(*s, max, 0);
+			s->trigger();
+			format_check(*s, max, 0);
+
+			// Test a store of one format opened with the other
+			options.compactTables = !first;
+			s.reset();
+			s.reset(new KVStore(FORMAT_DIR, options));
+			format_check(*s, max, 0);
+			phase();
+
+			// Test compaction merging tables of both formats
+			format_write(*s, max, 1);
+			format_check(*s, max, 1);
+			s->trigger();
+			format_write(*s, max, 2);
+			s->trigger();
+			format_check(*s, max, 2);
+			options.compactTables = first;
+			s.reset();
+			s.reset(new KVStore(FORMAT_DIR, options));
+			format_check(*s, max, 2);
+			phase();
+		}
+		std::filesystem::remove_all(FORMAT_DIR);
+		report();
+	}
+
+	const std::string TTL_DIR = "./data-ttl";
+
+	// even keys of ttl_test in [from, to) have expired, odd ones live on
+	void ttl_check(KVStore &s, uint64_t from, uint64_t to)
+	{
+		uint64_t i;
+		for (i = from; i < to; ++i)
+			EXPECT((i & 1) ? std::string("long") : not_found, s.get(i));
+		std::list<std::pair<uint64_t, std::string>> list;
+		s.scan(from, to - 1, list);
+		EXPECT((to - from) / 2, (uint64_t)list.size());
+		for (auto &p : list)
+			EXPECT(std::string("long"), p.second);
+	}
+
+	// puts 2 MB of values from key on
+	void ttl_fill(KVStore &s, uint64_t key)
+	{
+		for (uint64_t i = 0; i < 2048; ++i)
+			s.put(key + i, std::string(1024, 'x'));
+	}
+
+	void ttl_test(uint64_t max)
+	{
+		Options options;
+		options.writeAheadLog = true;
+		std::filesystem::remove_all(TTL_DIR);
+		std::unique_ptr<KVStore> s(new KVStore(TTL_DIR, options));
+		uint64_t i;
+
+		// older values in a table, keys below max expire in a table and
+		// the others in the memTable; a memTable full of other keys pushes
+		// the ones before out
+		for (i = 0; i < 2 * max; ++i)
+			s->put(i, "old");
+		ttl_fill(*s, 2 * max);
+		for (i = 0; i < 2 * max; ++i) {
+			s->put(i, (i & 1) ? "long" : "short", (i & 1) ? 3600 : 2);
+			if (i == max - 1)
+				ttl_fill(*s, 2 * max + 4096);
+		}
+		EXPECT(std::string("short"), s->get(0));
+		EXPECT(std::string("short"), s->get(max));
+		sleep(3);
 
+		// Test expiry in the memTable
+		ttl_check(*s, max, 2 * max);
 		phase();
 
+		// Test expiry in a table
+		ttl_check(*s, 0, max);
+		phase();
+
+		// Test after reopening the store
+		s.reset();
+		s.reset(new KVStore(TTL_DIR, options));
+		ttl_check(*s, 0, 2 * max);
+		phase();
+
+		// Test that compaction turns expired entries into tombstones
+		for (i = 0; i < 6; ++i)
+			ttl_fill(*s, 2 * max + 4096 * (i + 2));
+		EXPECT(true, s->getStats().expiredEntries >= max / 2);
+		ttl_check(*s, 0, 2 * max);
+		phase();
+
+		s.reset();
+		std::filesystem::remove_all(TTL_DIR);
+		report();
+	}
+
+	// the keys below max of s against model, by get and by scan
+	void map_check(KVStore &s, const std::map<uint64_t, std::string> &model,
+		       uint64_t max)
+	{
+		uint64_t i;
+		for (i = 0; i < max; ++i) {
+			auto it = model.find(i);
+			EXPECT(it != model.end() ? it->second : not_found, s.get(i));
+		}
+		std::list<std::pair<uint64_t, std::string>> list;
+		s.scan(0, max - 1, list);
+		std::vector<std::pair<uint64_t, std::string>> all(
+			model.begin(), model.lower_bound(max));
+		EXPECT(all.size(), list.size());
+		EXPECT(true, std::equal(all.begin(), all.end(), list.begin(),
+					list.end()));
+	}
+
+	const std::string INGEST_DIR = "./data-ingest";
+	const std::string SST_DIR = "./data-sst";
+
+	// tables built by an SstWriter small enough to spill and merge runs,
+	// ingested over stored entries of the same keys
+	void ingest_test(uint64_t max)
+	{
+		Options options;
+		options.writeAheadLog = true;
+		std::filesystem::remove_all(INGEST_DIR);
+		std::filesystem::remove_all(SST_DIR);
+		std::unique_ptr<KVStore> s(new KVStore(INGEST_DIR, options));
+		std::map<uint64_t, std::string> model;
+		std::mt19937_64 rng(max);
+		uint64_t i;
+
+		// stored entries in tables, a deleted range and the memTable
+		for (i = 0; i < max; ++i) {
+			s->put(i, "stored");
+			model[i] = "stored";
+		}
+		s->trigger();
+		s->deleteRange(max / 2, max / 2 + 99);
+		model.erase(model.lower_bound(max / 2),
+			    model.upper_bound(max / 2 + 99));
+		for (i = max; i < max + 100; ++i) {
+			s->put(i, "memory");
+			model[i] = "memory";
+		}
+
+		// Test that of the keys added several times the last add wins,
+		// across spilled runs too
+		{
+			SstWriter w(SST_DIR, options, 64 * 1024, 64 * 1024);
+			for (i = 0; i < 3 * max; ++i) {
+				uint64_t key = max / 4 + rng() % max;
+				std::string val = std::to_string(i);
+				w.add(key, val);
+				model[key] = val;
+			}
+			std::vector<std::string> paths = w.finish();
+			EXPECT(true, paths.size() > 1);
+			EXPECT(true, s->ingestFiles(paths));
+			for (auto &path : paths)
+				EXPECT(false, std::filesystem::exists(path));
+		}
+		map_check(*s, model, 2 * max);
+		phase();
+
+		// Test after reopening the store
+		s.reset();
+		s.reset(new KVStore(INGEST_DIR, options));
+		map_check(*s, model, 2 * max);
+		phase();
+
+		// Test that finish fails when a run can't be spilled
+		std::filesystem::remove_all(SST_DIR);
+		{
+			SstWriter w(SST_DIR, options, 64 * 1024, 64 * 1024);
+			std::filesystem::create_directories(
+				std::filesystem::path(SST_DIR) / "run-0" / "x");
+			for (i = 0; i < max; ++i)
+				w.add(i, "lost");
+			EXPECT(true, w.finish().empty());
+		}
+		map_check(*s, model, 2 * max);
+		phase();
+
+		s.reset();
+		std::filesystem::remove_all(INGEST_DIR);
+		std::filesystem::remove_all(SST_DIR);
+		report();
+	}
+
+	const std::string CHECKPOINT_DIR = "./data-checkpoint";
+	const std::string CHECKPOINT_COPY_DIR = "./data-checkpoint-copy";
+
+	// a checkpoint holds the entries at its time, those of tables, of
+	// the memTable in the log and of deleted ranges, whatever comes after
+	void checkpoint_test(uint64_t max)
+	{
+		Options options;
+		options.writeAheadLog = true;
+		std::filesystem::remove_all(CHECKPOINT_DIR);
+		std::filesystem::remove_all(CHECKPOINT_COPY_DIR);
+		std::unique_ptr<KVStore> s(new KVStore(CHECKPOINT_DIR, options));
+		std::map<uint64_t, std::string> model;
+		uint64_t i;
+
+		for (i = 0; i < max; ++i) {
+			s->put(i, std::string(i % 64 + 1, 'c'));
+			model[i] = std::string(i % 64 + 1, 'c');
+		}
+		s->trigger();
+		s->deleteRange(max / 4, max / 2);
+		model.erase(model.lower_bound(max / 4),
+			    model.upper_bound(max / 2));
+		for (i = 0; i < max; i += 7) {
+			s->put(i, "memory");
+			model[i] = "memory";
+		}
+		for (i = 3; i < max; i += 11)
+			if (model.erase(i))
+				s->del(i);
+		EXPECT(true, s->createCheckpoint(CHECKPOINT_COPY_DIR));
+
+		// Test the checkpoint while the store keeps writing, deleting
+		// and compacting
+		for (i = 0; i < max; ++i)
+			s->put(i, "later");
+		s->deleteRange(0, max / 8);
+		for (i = 0; i < 12 * 1024; ++i)
+			s->put(max + i, std::string(1024, 'x'));
+		{
+			KVStore c(CHECKPOINT_COPY_DIR, options);
+			map_check(c, model, 2 * max);
+		}
+		phase();
+
+		// Test the checkpoint after the store is gone, reopened twice
+		// since the first open flushes its log
+		s.reset();
+		std::filesystem::remove_all(CHECKPOINT_DIR);
+		for (int round = 0; round < 2; ++round) {
+			KVStore c(CHECKPOINT_COPY_DIR, options);
+			map_check(c, model, 2 * max);
+		}
+		phase();
+
+		std::filesystem::remove_all(CHECKPOINT_COPY_DIR);
+		report();
+	}
+
+	const std::string PINNED_DIR = "./data-pinned";
+
+	// pinned values of tables outlive the tables compaction deletes
+	void pinned_test(uint64_t max)
+	{
+		std::filesystem::remove_all(PINNED_DIR);
+		std::unique_ptr<KVStore> s(new KVStore(PINNED_DIR));
+		std::vector<PinnedValue> pinned;
+		uint64_t i;
+
+		for (i = 0; i < max; ++i)
+			s->put(i, std::string(i % 256 + 1, 'a' + i % 26));
+		s->trigger();
+		s->put(max, "memory");
+		for (i = 0; i <= max; ++i)
+			pinned.push_back(s->getPinned(i));
+
+		// Test the pinned values after overwrites and compactions have
+		// deleted their tables
+		for (i = 0; i < max; ++i)
+			s->put(i, "new");
+		for (i = 0; i < 12 * 1024; ++i)
+			s->put(max + 1 + i, std::string(1024, 'x'));
+		EXPECT(true, s->getStats().compactions > 0);
+		for (i = 0; i < max; ++i)
+			EXPECT(std::string(i % 256 + 1, 'a' + i % 26),
+			       pinned[i].toString());
+		EXPECT(std::string("memory"), pinned[max].toString());
+		EXPECT(true, s->getPinned(max + 1 + 12 * 1024).empty());
+		phase();
+
+		// Test that releasing them leaves the store as it is
+		pinned.clear();
+		for (i = 0; i < max; ++i)
+			EXPECT(std::string("new"), s->get(i));
+		phase();
+
+		s.reset();
+		std::filesystem::remove_all(PINNED_DIR);
+		report();
+	}
+
+	const std::string ASYNC_DIR = "./data-async";
+
+	// asynchronous gets in flight on the io threads while the store goes
+	// on with puts, deletions, flushes and compactions; each one returns
+	// the value of its key when it was called
+	void async_test(uint64_t max)
+	{
+		Options options;
+		options.memTableBytes = 64 * 1024;
+		options.ioThreads = 4;
+		std::filesystem::remove_all(ASYNC_DIR);
+		std::unique_ptr<KVStore> s(new KVStore(ASYNC_DIR, options));
+		std::map<uint64_t, std::string> model;
+		std::mt19937_64 rng(max);
+		std::mutex mutex;
+		std::vector<std::pair<std::string, std::string>> results;
+		std::atomic<uint64_t> pending(0);
+		uint64_t i;
+
+		for (i = 0; i < max; ++i) {
+			s->put(i, std::string(i % 256 + 1, 'a' + i % 26));
+			model[i] = std::string(i % 256 + 1, 'a' + i % 26);
+		}
+
+		// Test gets interleaved with writes
+		for (i = 0; i < 16 * max; ++i) {
+			uint64_t key = rng() % max;
+			switch (rng() % 4) {
+			case 0:
+				s->put(key, std::string(i % 256 + 1, 'a' + i % 26));
+				model[key] = std::string(i % 256 + 1, 'a' + i % 26);
+				break;
+			case 1:
+				EXPECT(model.erase(key) > 0, s->del(key));
+				break;
+			default: {
+				auto it = model.find(key);
+				std::string exp = it != model.end() ? it->second
+								    : not_found;
+				pending++;
+				s->getAsync(key, [&, exp](const std::string &val) {
+					std::lock_guard<std::mutex> lock(mutex);
+					results.emplace_back(exp, val);
+					pending--;
+				});
+			}
+			}
+		}
+		while (pending > 0)
+			std::this_thread::yield();
+		EXPECT(true, s->getStats().flushBytes > 0);
+		EXPECT(true, results.size() > 4 * max);
+		for (auto &r : results)
+			EXPECT(r.first, r.second);
+		phase();
+
+		s.reset();
+		std::filesystem::remove_all(ASYNC_DIR);
+		report();
+	}
+
+	const std::string VLOG_DIR = "./data-vlog";
+
+	// the value of key in round of vlog_test, most of them large enough
+	// for the value log
+	std::string vlog_value(uint64_t key, int round)
+	{
+		return std::string(key % 3 ? 300 + key % 700 : key % 64 + 1,
+				   'a' + (key + round) % 26);
+	}
+
+	// large values overwritten, deleted and reclaimed from the value log
+	void vlog_test(uint64_t max)
+	{
+		Options options;
+		options.writeAheadLog = true;
+		options.valueLogThreshold = 256;
+		options.valueLogFileSize = 256 * 1024;
+		std::filesystem::remove_all(VLOG_DIR);
+		std::unique_ptr<KVStore> s(new KVStore(VLOG_DIR, options));
+		std::map<uint64_t, std::string> model;
+		uint64_t i;
+
+		for (i = 0; i < max; ++i) {
+			s->put(i, vlog_value(i, 0));
+			model[i] = vlog_value(i, 0);
+		}
+		for (i = 0; i < max; i += 2) {
+			s->put(i, vlog_value(i, 1));
+			model[i] = vlog_value(i, 1);
+		}
+		for (i = 1; i < max; i += 6)
+			if (model.erase(i))
+				EXPECT(true, s->del(i));
+		s->deleteRange(max / 2, max / 2 + max / 8);
+		model.erase(model.lower_bound(max / 2),
+			    model.upper_bound(max / 2 + max / 8));
+
+		// Test the values before and after garbage collection
+		map_check(*s, model, max);
+		EXPECT(true, s->getStats().valueLogBytes > 0);
+		// the live values a collection puts again fill later files, so
+		// the log is collected a few files at a time
+		int collected = 0;
+		while (collected < 8 && s->garbageCollectValueLog())
+			collected++;
+		EXPECT(8, collected);
+		map_check(*s, model, max);
+		phase();
+
+		// Test after more writes and compactions
+		for (i = 0; i < max; i += 3) {
+			s->put(i, vlog_value(i, 2));
+			model[i] = vlog_value(i, 2);
+		}
+		for (i = 0; i < 4096; ++i)
+			s->put(max + i, std::string(1024, 'x'));
+		for (collected = 0; collected < 8; ++collected)
+			EXPECT(true, s->garbageCollectValueLog());
+		map_check(*s, model, max);
+		phase();
+
+		// Test after reopening the store
+		s.reset();
+		s.reset(new KVStore(VLOG_DIR, options));
+		map_check(*s, model, max);
+		phase();
+
+		s.reset();
+		std::filesystem::remove_all(VLOG_DIR);
+		report();
+	}
+
+	const std::string ROW_CACHE_DIR = "./data-row-cache";
+
+	// keys of row_cache_test in [0, max) after its writes
+	void row_cache_check(KVStore &s, uint64_t max)
+	{
+		uint64_t i;
+		for (i = 0; i < max; ++i) {
+			std::string exp = i >= max / 2 ? not_found :
+					  i % 4 == 0 ? "put" :
+					  i % 4 == 1 ? not_found : "table";
+			EXPECT(exp, s.get(i));
+		}
+	}
+
+	// puts 256 KB of values from key on, which pushes the small
+	// memTable of row_cache_test out to the tables
+	void row_cache_fill(KVStore &s, uint64_t key)
+	{
+		for (uint64_t i = 0; i < 256; ++i)
+			s.put(key + i, std::string(1024, 'x'));
+	}
+
+	// a value a get has cached gives way to every later write of its key,
+	// in the memTable and once flushed
+	void row_cache_test(uint64_t max)
+	{
+		Options options;
+		options.memTableBytes = 64 * 1024;
+		options.rowCacheBytes = 1024 * 1024;
+		std::filesystem::remove_all(ROW_CACHE_DIR);
+		std::unique_ptr<KVStore> s(new KVStore(ROW_CACHE_DIR, options));
+		uint64_t i;
+
+		for (i = 0; i < max; ++i)
+			s->put(i, "table");
+		row_cache_fill(*s, max);
+		for (int round = 0; round < 2; ++round)
+			for (i = 0; i < max; ++i)
+				EXPECT(std::string("table"), s->get(i));
+		EXPECT(true, s->getStats().rowCacheHits >= max);
+
+		// Test a put, a deletion and a deleted range of cached keys
+		for (i = 0; i < max; i += 4)
+			s->put(i, "put");
+		for (i = 1; i < max; i += 4)
+			EXPECT(true, s->del(i));
+		s->deleteRange(max / 2, max - 1);
+		row_cache_check(*s, max);
+		phase();
+
+		// Test the same once the writes are in the tables, read twice
+		// so the second read may come from the cache
+		row_cache_fill(*s, 2 * max);
+		row_cache_check(*s, max);
+		row_cache_check(*s, max);
+		for (i = 2; i < max / 2; i += 4)
+			s->put(i, "again");
+		row_cache_fill(*s, 3 * max);
+		for (i = 2; i < max / 2; i += 4)
+			EXPECT(std::string("again"), s->get(i));
+		phase();
+
+		s.reset();
+		std::filesystem::remove_all(ROW_CACHE_DIR);
+		report();
+	}
+
+	const std::string INDEX_DIR = "./data-index";
+
+	// the scan of [key1, key2] in s against model
+	void scan_check(KVStore &s, const std::map<uint64_t, std::string> &model,
+			uint64_t key1, uint64_t key2)
+	{
+		std::list<std::pair<uint64_t, std::string>> list;
+		s.scan(key1, key2, list);
+		std::vector<std::pair<uint64_t, std::string>> all(
+			model.lower_bound(key1), model.upper_bound(key2));
+		EXPECT(all.size(), list.size());
+		EXPECT(true, std::equal(all.begin(), all.end(), list.begin(),
+					list.end()));
+	}
+
+	// clusters of 256 keys, 1 << 20 apart, so that whole ranges between
+	// them hold no key
+	uint64_t index_key(uint64_t i)
+	{
+		return (i / 256) << 20 | (i % 256) * 3;
+	}
+
+	void index_check(KVStore &s, const std::map<uint64_t, std::string> &model,
+			 uint64_t max)
+	{
+		uint64_t i;
+		for (i = 0; i < max; ++i) {
+			uint64_t key = index_key(i);
+			auto it = model.find(key);
+			EXPECT(it != model.end() ? it->second : not_found,
+			       s.get(key));
+			EXPECT(not_found, s.get(key + 1));
+		}
+		for (i = 0; i < max; i += 256) {
+			uint64_t key = index_key(i);
+			// within a cluster, over its end and in the gap after it
+			scan_check(s, model, key + 10, key + 100);
+			scan_check(s, model, key + 700, key + 900);
+			scan_check(s, model, key + 1000, key + (1 << 19));
+		}
+		scan_check(s, model, index_key(max), UINT64_MAX);
+	}
+
+	// gets and scans with range filters, learned models and index blocks
+	// read through the cache, on tables large enough for each
+	void index_test(uint64_t max)
+	{
+		Options filter, learned, cached;
+		filter.rangeFilterBitsPerKey = 16;
+		learned.learnedIndexError = 16;
+		learned.pinnedIndexLevels = 0;
+		cached.indexCacheBytes = 64 * 1024;
+		cached.pinnedIndexLevels = 0;
+		for (const Options *options : {&filter, &learned, &cached}) {
+			std::filesystem::remove_all(INDEX_DIR);
+			std::unique_ptr<KVStore> s(
+				new KVStore(INDEX_DIR, *options));
+			std::map<uint64_t, std::string> model;
+			std::mt19937_64 rng(max);
+			uint64_t i;
+
+			// Test after random puts and deletions
+			for (i = 0; i < 2 * max; ++i) {
+				uint64_t key = index_key(rng() % max);
+				if (rng() % 4) {
+					std::string val(64 + i % 64, 'a' + i % 26);
+					s->put(key, val);
+					model[key] = val;
+				} else if (model.erase(key)) {
+					EXPECT(true, s->del(key));
+				}
+			}
+			s->trigger();
+			index_check(*s, model, max);
+			phase();
+
+			// Test after reopening the store, the memTable is in
+			// the tables
+			s.reset();
+			s.reset(new KVStore(INDEX_DIR, *options));
+			index_check(*s, model, max);
+			if (options == &filter)
+				EXPECT(true, s->getStats().filterSkips > 0);
+			// the models stand in for the 16 bytes per key of the
+			// index tables
+			if (options == &learned)
+				EXPECT(true, s->indexMemoryBytes() < max);
+			if (options == &cached)
+				EXPECT(true, s->getStats().indexCacheHits > 0 &&
+					     s->getStats().indexCacheMisses > 0);
+			phase();
+
+			s.reset();
+		}
+		std::filesystem::remove_all(INDEX_DIR);
+		report();
+	}
+
+	const std::string INCREMENTAL_DIR = "./data-incremental";
+
+	// incremental compaction of a job whose slices are larger than two
+	// tables, as a few keys with large values make them
+	void incremental_test(uint64_t max)
+	{
+		Options options;
+		options.memTableBytes = 64 * 1024;
+		options.tableBytes = 64 * 1024;
+		options.incrementalCompactionRatio = 1;
+		std::filesystem::remove_all(INCREMENTAL_DIR);
+		std::unique_ptr<KVStore> s(new KVStore(INCREMENTAL_DIR, options));
+		uint64_t i;
+
+		// Test that the writes finish the job before level 0 holds four
+		// times the trigger and stalls them
+		const uint64_t tables = 4 * options.l0CompactionTrigger - 1;
+		for (i = 0; i < tables; ++i)
+			s->put(i, std::string(160 * 1024, 'a' + i % 26));
+		EXPECT(true, s->getStats().compactions > 0);
+		for (i = 0; i < tables; ++i)
+			EXPECT(std::string(160 * 1024, 'a' + i % 26), s->get(i));
+		phase();
+
+		// Test small writes after it
+		for (i = 0; i < max; ++i)
+			s->put(tables + i, std::to_string(i));
+		for (i = 0; i < max; ++i)
+			EXPECT(std::to_string(i), s->get(tables + i));
+		for (i = 0; i < tables; ++i)
+			EXPECT(std::string(160 * 1024, 'a' + i % 26), s->get(i));
+		phase();
+
+		s.reset();
+		std::filesystem::remove_all(INCREMENTAL_DIR);
+		report();
+	}
+
+	const std::string SHARDED_DIR = "./data-sharded";
+
+	void sharded_check(ShardedKVStore &s,
+			   const std::map<uint64_t, std::string> &model,
+			   uint64_t max)
+	{
+		uint64_t i;
+		for (i = 0; i < max; ++i) {
+			auto it = model.find(i);
+			EXPECT(it != model.end() ? it->second : not_found, s.get(i));
+		}
+		std::list<std::pair<uint64_t, std::string>> list;
+		s.scan(0, max - 1, list);
+		std::vector<std::pair<uint64_t, std::string>> all(model.begin(),
+								 model.end());
+		EXPECT(model.size(), list.size());
+		EXPECT(true, std::equal(all.begin(), all.end(), list.begin(),
+					list.end()));
+	}
+
+	void sharded_test(uint64_t max)
+	{
+		Options options;
+		options.memTableBytes = 64 * 1024;
+		options.writeAheadLog = true;
+		std::filesystem::remove_all(SHARDED_DIR);
+		std::unique_ptr<ShardedKVStore> s(
+			new ShardedKVStore(SHARDED_DIR, 4, options));
+		std::map<uint64_t, std::string> model;
+		uint64_t i;
+
+		// Test puts, deletions and scans across the shards
+		for (i = 0; i < max; ++i) {
+			s->put(i, std::string(i % 128 + 1, 'a' + i % 26));
+			model[i] = std::string(i % 128 + 1, 'a' + i % 26);
+		}
+		for (i = 0; i < max; i += 3) {
+			EXPECT(true, s->del(i));
+			model.erase(i);
+		}
+		s->deleteRange(max / 4, max / 2);
+		model.erase(model.lower_bound(max / 4),
+			    model.upper_bound(max / 2));
+		sharded_check(*s, model, max);
+		phase();
+
+		// Test after reopening the store
+		s.reset();
+		s.reset(new ShardedKVStore(SHARDED_DIR, 4, options));
+		EXPECT(4, s->size());
+		sharded_check(*s, model, max);
+		phase();
+
+		// Test that a store reopened with another count keeps its own
+		s.reset();
+		s.reset(new ShardedKVStore(SHARDED_DIR, 3, options));
+		EXPECT(4, s->size());
+		sharded_check(*s, model, max);
+		phase();
+
+		s.reset();
+		std::filesystem::remove_all(SHARDED_DIR);
+		report();
+	}
+
+	const std::string FIXED_DIR = "./data-fixed";
+
+	void fixed_check(FixedKVStore<uint64_t> &s,
+			 const std::map<uint64_t, uint64_t> &model, uint64_t max)
+	{
+		uint64_t i, value;
+		for (i = 0; i < max; ++i) {
+			auto it = model.find(i);
+			EXPECT(it != model.end(), s.get(i, &value));
+			if (it != model.end())
+				EXPECT(it->second, value);
+		}
+		std::vector<std::pair<uint64_t, uint64_t>> list;
+		s.scan(0, max - 1, list);
+		std::vector<std::pair<uint64_t, uint64_t>> all(model.begin(),
+							      model.end());
+		EXPECT(model.size(), list.size());
+		EXPECT(true, list == all);
+	}
+
+	// FixedKVStore against a std::map, with a small memTable so random
+	// puts and deletions go through many flushes and merges
+	void fixed_test(uint64_t max)
+	{
+		Options options;
+		options.memTableBytes = 16 * 1024;
+		std::filesystem::remove_all(FIXED_DIR);
+		std::unique_ptr<FixedKVStore<uint64_t>> s(
+			new FixedKVStore<uint64_t>(FIXED_DIR, options));
+		std::map<uint64_t, uint64_t> model;
+		std::mt19937_64 rng(max);
+		uint64_t i, value;
+
+		// Test random puts, deletions and gets
+		for (int round = 0; round < 4; ++round) {
+			for (i = 0; i < 8 * max; ++i) {
+				uint64_t key = rng() % max;
+				switch (rng() % 4) {
+				case 0:
+				case 1:
+					value = rng();
+					s->put(key, value);
+					model[key] = value;
+					break;
+				case 2:
+					EXPECT(model.erase(key) > 0, s->del(key));
+					break;
+				default:
+					EXPECT(model.count(key) > 0, s->get(key, &value));
+					if (model.count(key))
+						EXPECT(model[key], value);
+				}
+			}
+			fixed_check(*s, model, max);
+			// Test after reopening the store, closed first to flush
+			s.reset();
+			s.reset(new FixedKVStore<uint64_t>(FIXED_DIR, options));
+			fixed_check(*s, model, max);
+		}
+		phase();
+
+		// Test reset
+		s->reset();
+		model.clear();
+		fixed_check(*s, model, max);
+		phase();
+
+		s.reset();
+		std::filesystem::remove_all(FIXED_DIR);
 		report();
 	}
 
@@ -61,10 +1001,61 @@ public:
 		std::cout << "KVStore Correctness Test" << std::endl;
 
 		std::cout << "[Simple Test]" << std::endl;
-		regular_test(SIMPLE_TEST_MAX);
+		regular_test(store, SIMPLE_TEST_MAX);
 
 		std::cout << "[Large Test]" << std::endl;
-		regular_test(LARGE_TEST_MAX);
+		regular_test(store, LARGE_TEST_MAX);
+
+		std::cout << "[Range Deletion Test]" << std::endl;
+		range_test(LARGE_TEST_MAX / 4);
+
+		std::cout << "[Tiered Compaction Test]" << std::endl;
+		Options tiered;
+		tiered.compactionStyle = CompactionStyle::Tiered;
+		compaction_test(tiered, LARGE_TEST_MAX / 4);
+
+		std::cout << "[Subcompaction Test]" << std::endl;
+		// small tables split most compactions over the threads
+		Options split;
+		split.maxSubcompactions = 4;
+		split.tableBytes = 256 * 1024;
+		compaction_test(split, LARGE_TEST_MAX / 4);
+
+		std::cout << "[Table Format Test]" << std::endl;
+		format_test(LARGE_TEST_MAX / 2);
+
+		std::cout << "[TTL Test]" << std::endl;
+		ttl_test(SIMPLE_TEST_MAX * 8);
+
+		std::cout << "[Ingest Test]" << std::endl;
+		ingest_test(LARGE_TEST_MAX / 8);
+
+		std::cout << "[Checkpoint Test]" << std::endl;
+		checkpoint_test(LARGE_TEST_MAX / 8);
+
+		std::cout << "[Pinned Get Test]" << std::endl;
+		pinned_test(LARGE_TEST_MAX / 8);
+
+		std::cout << "[Async Get Test]" << std::endl;
+		async_test(LARGE_TEST_MAX / 8);
+
+		std::cout << "[Value Log Test]" << std::endl;
+		vlog_test(LARGE_TEST_MAX / 8);
+
+		std::cout << "[Row Cache Test]" << std::endl;
+		row_cache_test(LARGE_TEST_MAX / 8);
+
+		std::cout << "[Index Test]" << std::endl;
+		index_test(LARGE_TEST_MAX / 2);
+
+		std::cout << "[Incremental Compaction Test]" << std::endl;
+		incremental_test(LARGE_TEST_MAX);
+
+		std::cout << "[Sharded Test]" << std::endl;
+		sharded_test(SIMPLE_TEST_MAX * 16);
+
+		std::cout << "[Fixed Width Test]" << std::endl;
+		fixed_test(SIMPLE_TEST_MAX * 8);
 	}
 };
 
@@ -0,0 +1,442 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "index_search.h"
+#include "mapped_file.h"
+#include "options.h"
+#include "table_builder.h"
+
+// Stores a value of type T in SIZE bytes. The default copies the bytes of a
+// trivially copyable type; a codec for another type provides the same
+// members.
+template <typename T>
+struct FixedCodec {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "FixedCodec copies the bytes of the value");
+    static constexpr size_t SIZE = sizeof(T);
+
+    static void encode(const T &value, char *dst) {
+        memcpy(dst, &value, SIZE);
+    }
+
+    static T decode(const char *src) {
+        T value;
+        memcpy(&value, src, SIZE);
+        return value;
+    }
+};
+
+// A KVStore for values of a fixed width known at compile time, such as
+// 8, 16 or 32-byte records. Entries carry no length field and no time:
+// the memTable is an open addressing hash table of slots holding the
+// encoded value inline, and a table is three arrays,
+// +----------------------------------------------------------------+
+// |magic|width|count|keys: 8 bytes each|values: width bytes each|  |
+// |deleted: a bit per key                                          |
+// +----------------------------------------------------------------+
+// mapped whole, so a get searches the keys in the mapping and decodes the
+// value next to them without allocating. Tables live in dir/table-<n>, the
+// higher the number the newer; after a flush the newest two are merged as
+// long as the newer is at least half the size of the older, like the
+// digits of a binary counter, which keeps O(log n) tables. Only
+// Options::memTableBytes, syncTables and verbose apply. The memTable is
+// flushed when the store is closed. No operation may run concurrently with
+// another.
+template <typename Value, typename Codec = FixedCodec<Value>>
+class FixedKVStore {
+   public:
+    FixedKVStore(const std::string &dir, const Options &options = Options());
+
+    ~FixedKVStore();
+
+    void put(uint64_t key, const Value &value);
+
+    // saves the value of key in value, false if it is not found
+    bool get(uint64_t key, Value *value) const;
+
+    // returns false iff the key is not found
+    bool del(uint64_t key);
+
+    // appends the entries with keys in [key1, key2] in ascending order
+    void scan(uint64_t key1, uint64_t key2,
+              std::vector<std::pair<uint64_t, Value>> &list) const;
+
+    void reset();
+
+    // the total size in bytes of all tables
+    uint64_t sizeOnDisk() const;
+
+   private:
+    static constexpr size_t WIDTH = Codec::SIZE;
+    static constexpr uint64_t MAGIC = 0x6465786966766bf0;
+    static constexpr uint64_t HEADER_SIZE = 24;
+
+    enum State : uint8_t { EMPTY, LIVE, DELETED };
+
+    struct Slot {
+        uint64_t key;
+        State state;
+        char value[WIDTH];
+    };
+
+    // a mapped table, its arrays point into the mapping
+    struct Table {
+        uint64_t number;
+        std::shared_ptr<MappedFile> file;
+        uint64_t count;
+        const uint64_t *keys;
+        const char *values;
+        const uint8_t *deleted;
+
+        bool isDeleted(uint64_t i) const {
+            return deleted[i / 8] & (1 << (i % 8));
+        }
+    };
+
+    std::string dir;
+    Options options;
+
+    std::vector<Slot> slots;  // a power of two of them
+    uint64_t entries = 0;     // the slots in use
+    uint64_t maxEntries;      // the entries that fill the memTable
+
+    std::vector<Table> tables;  // from the newest
+    uint64_t tableNumber = 0;   // the number of the newest table
+
+    // the slot of key, or the empty slot it would take
+    uint64_t slotOf(uint64_t key) const;
+
+    void set(uint64_t key, State state, const char *value);
+
+    // doubles the slots, for a memTable that outgrows them while its table
+    // can't be written
+    void grow();
+
+    // writes the memTable to a table and merges tables; the memTable is
+    // kept if the table can't be written
+    void flush();
+
+    // merges tables[0] into tables[1], dropping deletions if tables[1] is
+    // the oldest; false if the merged table can't be written, the two stay
+    bool merge();
+
+    // writes sorted arrays to a new table and maps it
+    Table writeTable(const std::vector<uint64_t> &keys,
+                     const std::string &values,
+                     const std::vector<uint8_t> &deleted);
+
+    // maps the table at path, false if it isn't a table of this width
+    bool mapTable(const std::string &path, uint64_t number, Table *table);
+
+    std::string tablePath(uint64_t number) const {
+        return (std::filesystem::path(dir) /
+                ("table-" + std::to_string(number)))
+            .string();
+    }
+};
+
+template <typename Value, typename Codec>
+FixedKVStore<Value, Codec>::FixedKVStore(const std::string &dir,
+                                         const Options &options)
+    : dir(dir), options(options) {
+    // a slot per entry of the table size, at most half of them in use
+    maxEntries = std::max((uint64_t)1024, options.memTableBytes / (8 + WIDTH));
+    uint64_t n = 1;
+    while (n < 2 * maxEntries) n *= 2;
+    slots.resize(n);
+    std::filesystem::create_directories(dir);
+    for (auto &e : std::filesystem::directory_iterator(dir)) {
+        std::string name = e.path().filename().string();
+        if (name.rfind("table-", 0) != 0) continue;
+        Table t;
+        uint64_t number = std::stoull(name.substr(6));
+        if (!mapTable(e.path().string(), number, &t)) {
+            std::clog << "error reading " << e.path() << std::endl;
+            continue;
+        }
+        tables.push_back(t);
+        tableNumber = std::max(tableNumber, number);
+    }
+    std::sort(tables.begin(), tables.end(),
+              [](const Table &a, const Table &b) {
+                  return a.number > b.number;
+              });
+}
+
+template <typename Value, typename Codec>
+FixedKVStore<Value, Codec>::~FixedKVStore() {
+    flush();
+}
+
+template <typename Value, typename Codec>
+uint64_t FixedKVStore<Value, Codec>::slotOf(uint64_t key) const {
+    uint64_t mask = slots.size() - 1;
+    // Fibonacci hashing spreads sequential keys
+    uint64_t i = (key * 0x9e3779b97f4a7c15ULL) >> 17 & mask;
+    while (slots[i].state != EMPTY && slots[i].key != key) i = (i + 1) & mask;
+    return i;
+}
+
+template <typename Value, typename Codec>
+void FixedKVStore<Value, Codec>::set(uint64_t key, State state,
+                                     const char *value) {
+    Slot &slot = slots[slotOf(key)];
+    if (slot.state == EMPTY) entries++;
+    slot.key = key;
+    slot.state = state;
+    if (value) memcpy(slot.value, value, WIDTH);
+    if (entries >= maxEntries) flush();
+    if (2 * entries >= slots.size()) grow();
+}
+
+template <typename Value, typename Codec>
+void FixedKVStore<Value, Codec>::grow() {
+    std::vector<Slot> old(2 * slots.size());
+    old.swap(slots);
+    for (auto &s : old)
+        if (s.state != EMPTY) slots[slotOf(s.key)] = s;
+}
+
+template <typename Value, typename Codec>
+void FixedKVStore<Value, Codec>::put(uint64_t key, const Value &value) {
+    if (options.verbose) std::clog << "+ " << key << std::endl;
+    char buf[WIDTH];
+    Codec::encode(value, buf);
+    set(key, LIVE, buf);
+}
+
+template <typename Value, typename Codec>
+bool FixedKVStore<Value, Codec>::get(uint64_t key, Value *value) const {
+    const Slot &slot = slots[slotOf(key)];
+    if (slot.state != EMPTY) {
+        if (slot.state == DELETED) return false;
+        if (value) *value = Codec::decode(slot.value);
+        return true;
+    }
+    for (auto &t : tables) {
+        int i = searchKeys(t.keys, t.count, key);
+        if (i < 0) continue;
+        if (t.isDeleted(i)) return false;
+        if (value) *value = Codec::decode(t.values + i * WIDTH);
+        return true;
+    }
+    return false;
+}
+
+template <typename Value, typename Codec>
+bool FixedKVStore<Value, Codec>::del(uint64_t key) {
+    if (options.verbose) std::clog << "- " << key << std::endl;
+    bool exists = get(key, nullptr);
+    // the tables may hold older values of the key
+    if (exists) set(key, DELETED, nullptr);
+    return exists;
+}
+
+template <typename Value, typename Codec>
+void FixedKVStore<Value, Codec>::scan(
+    uint64_t key1, uint64_t key2,
+    std::vector<std::pair<uint64_t, Value>> &list) const {
+    // the newest entry of a key wins, deletions included
+    std::vector<std::pair<uint64_t, const char *>> found;
+    for (auto &s : slots)
+        if (s.state != EMPTY && key1 <= s.key && s.key <= key2)
+            found.emplace_back(s.key, s.state == LIVE ? s.value : nullptr);
+    std::sort(found.begin(), found.end());
+    for (auto &t : tables) {
+        const uint64_t *end = t.keys + t.count;
+        size_t before = found.size();
+        for (const uint64_t *k = std::lower_bound(t.keys, end, key1);
+             k != end && *k <= key2; k++) {
+            uint64_t i = k - t.keys;
+            found.emplace_back(
+                *k, t.isDeleted(i) ? nullptr : t.values + i * WIDTH);
+        }
+        // the entries of newer sources come first among equal keys
+        std::inplace_merge(found.begin(), found.begin() + before, found.end(),
+                           [](const std::pair<uint64_t, const char *> &a,
+                              const std::pair<uint64_t, const char *> &b) {
+                               return a.first < b.first;
+                           });
+        found.erase(std::unique(found.begin(), found.end(),
+                                [](const std::pair<uint64_t, const char *> &a,
+                                   const std::pair<uint64_t, const char *> &b) {
+                                    return a.first == b.first;
+                                }),
+                    found.end());
+    }
+    for (auto &f : found)
+        if (f.second) list.emplace_back(f.first, Codec::decode(f.second));
+}
+
+template <typename Value, typename Codec>
+void FixedKVStore<Value, Codec>::reset() {
+    std::fill(slots.begin(), slots.end(), Slot());
+    entries = 0;
+    for (auto &t : tables) std::filesystem::remove(tablePath(t.number));
+    tables.clear();
+    tableNumber = 0;
+}
+
+template <typename Value, typename Codec>
+uint64_t FixedKVStore<Value, Codec>::sizeOnDisk() const {
+    uint64_t bytes = 0;
+    for (auto &t : tables) bytes += t.file->size();
+    return bytes;
+}
+
+template <typename Value, typename Codec>
+void FixedKVStore<Value, Codec>::flush() {
+    if (entries == 0) return;
+    std::vector<const Slot *> sorted;
+    sorted.reserve(entries);
+    for (auto &s : slots)
+        if (s.state != EMPTY) sorted.push_back(&s);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const Slot *a, const Slot *b) { return a->key < b->key; });
+    std::vector<uint64_t> keys(sorted.size());
+    std::string values(sorted.size() * WIDTH, '\0');
+    std::vector<uint8_t> deleted((sorted.size() + 7) / 8, 0);
+    // with no table below, a deletion has nothing left to hide
+    size_t n = 0;
+    for (const Slot *s : sorted) {
+        if (s->state == DELETED && tables.empty()) continue;
+        keys[n] = s->key;
+        if (s->state == DELETED)
+            deleted[n / 8] |= 1 << (n % 8);
+        else
+            memcpy(&values[n * WIDTH], s->value, WIDTH);
+        n++;
+    }
+    keys.resize(n);
+    values.resize(n * WIDTH);
+    deleted.resize((n + 7) / 8);
+    if (n > 0) {
+        Table t = writeTable(keys, values, deleted);
+        if (!t.file) return;
+        tables.insert(tables.begin(), t);
+    }
+    std::fill(slots.begin(), slots.end(), Slot());
+    entries = 0;
+    while (tables.size() >= 2 && tables[0].count * 2 >= tables[1].count)
+        if (!merge()) break;
+}
+
+template <typename Value, typename Codec>
+bool FixedKVStore<Value, Codec>::merge() {
+    const Table &a = tables[0], &b = tables[1];
+    bool bottom = tables.size() == 2;
+    std::vector<uint64_t> keys;
+    std::string values;
+    std::vector<uint8_t> deleted;
+    keys.reserve(a.count + b.count);
+    values.reserve((a.count + b.count) * WIDTH);
+    uint64_t i = 0, j = 0;
+    while (i < a.count || j < b.count) {
+        const Table *t;
+        uint64_t k;
+        // a is newer and wins a key both hold
+        if (j == b.count || (i < a.count && a.keys[i] <= b.keys[j])) {
+            if (j < b.count && a.keys[i] == b.keys[j]) j++;
+            t = &a;
+            k = i++;
+        } else {
+            t = &b;
+            k = j++;
+        }
+        bool del = t->isDeleted(k);
+        if (del && bottom) continue;
+        if (keys.size() % 8 == 0) deleted.push_back(0);
+        if (del) deleted.back() |= 1 << (keys.size() % 8);
+        keys.push_back(t->keys[k]);
+        if (del)
+            values.append(WIDTH, '\0');
+        else
+            values.append(t->values + k * WIDTH, WIDTH);
+    }
+    Table t;
+    if (!keys.empty()) {
+        t = writeTable(keys, values, deleted);
+        if (!t.file) return false;
+    }
+    uint64_t numbers[] = {a.number, b.number};
+    tables.erase(tables.begin(), tables.begin() + 2);
+    if (!keys.empty()) tables.insert(tables.begin(), t);
+    for (uint64_t number : numbers) std::filesystem::remove(tablePath(number));
+    return true;
+}
+
+template <typename Value, typename Codec>
+typename FixedKVStore<Value, Codec>::Table
+FixedKVStore<Value, Codec>::writeTable(const std::vector<uint64_t> &keys,
+                                       const std::string &values,
+                                       const std::vector<uint8_t> &deleted) {
+    uint64_t header[] = {MAGIC, WIDTH, keys.size()};
+    std::string buf(reinterpret_cast<const char *>(header), HEADER_SIZE);
+    buf.append(reinterpret_cast<const char *>(keys.data()), keys.size() * 8);
+    buf += values;
+    buf.append(reinterpret_cast<const char *>(deleted.data()), deleted.size());
+    // the table is written to a temporary file and renamed once complete
+    std::string tmp = (std::filesystem::path(dir) / "table.tmp").string();
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    size_t done = 0;
+    while (fd >= 0 && done < buf.length()) {
+        ssize_t n = ::write(fd, buf.data() + done, buf.length() - done);
+        if (n <= 0) break;
+        done += n;
+    }
+    if (fd >= 0 && options.syncTables) fdatasync(fd);
+    if (fd >= 0) close(fd);
+    Table t;
+    t.file = nullptr;
+    if (fd < 0 || done != buf.length()) {
+        std::clog << "error writing " << tmp << std::endl;
+        return t;
+    }
+    uint64_t number = ++tableNumber;
+    std::filesystem::rename(tmp, tablePath(number));
+    if (options.syncTables) syncDir(dir);
+    if (options.verbose)
+        std::clog << keys.size() << " entries -> " << tablePath(number)
+                  << std::endl;
+    if (!mapTable(tablePath(number), number, &t))
+        std::clog << "error reading " << tablePath(number) << std::endl;
+    return t;
+}
+
+template <typename Value, typename Codec>
+bool FixedKVStore<Value, Codec>::mapTable(const std::string &path,
+                                          uint64_t number, Table *table) {
+    table->file = MappedFile::open(path);
+    if (!table->file || table->file->size() < HEADER_SIZE) return false;
+    const char *data = table->file->data();
+    uint64_t header[3];
+    memcpy(header, data, HEADER_SIZE);
+    uint64_t count = header[2];
+    if (header[0] != MAGIC || header[1] != WIDTH ||
+        table->file->size() !=
+            HEADER_SIZE + count * (8 + WIDTH) + (count + 7) / 8) {
+        table->file = nullptr;
+        return false;
+    }
+    table->number = number;
+    table->count = count;
+    // the mapping is page aligned, the keys start 8-byte aligned
+    table->keys = reinterpret_cast<const uint64_t *>(data + HEADER_SIZE);
+    table->values = data + HEADER_SIZE + count * 8;
+    table->deleted = reinterpret_cast<const uint8_t *>(table->values) +
+                     count * WIDTH;
+    return true;
+}
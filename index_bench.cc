@@ -0,0 +1,53 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "index_search.h"
+
+// Compares the lookups per second of the index table searches, e.g.
+//   ./index_bench [lookups]
+// Tables hold the even keys in [0, 2n), half of the lookups miss.
+
+struct Implementation {
+    const char *name;
+    int (*search)(const uint64_t *, size_t, uint64_t);
+};
+
+int main(int argc, char *argv[]) {
+    uint64_t lookups = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+    const Implementation impls[] = {
+        {"binary", searchKeysBinary}, {"scalar", searchKeysScalar},
+        {"sse4.2", searchKeysSse},    {"avx2", searchKeysAvx2},
+        {"searchKeys", searchKeys},
+    };
+    std::cout << "searchKeys uses " << searchKeysImpl() << std::endl;
+    std::cout << "keys";
+    for (auto &impl : impls) std::cout << "\t" << impl.name;
+    std::cout << "\t(million lookups/s)" << std::endl;
+    for (size_t n = 1000; n <= 1000000; n *= 10) {
+        std::vector<uint64_t> keys(n);
+        for (size_t i = 0; i < n; i++) keys[i] = i * 2;
+        std::mt19937_64 rng(301);
+        std::vector<uint64_t> targets(lookups);
+        for (auto &t : targets) t = rng() % (n * 2);
+        std::vector<int> expected;
+        for (auto t : targets)
+            expected.push_back(searchKeysBinary(keys.data(), n, t));
+        std::cout << n;
+        for (auto &impl : impls) {
+            uint64_t wrong = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t i = 0; i < lookups; i++)
+                wrong += impl.search(keys.data(), n, targets[i]) != expected[i];
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            std::cout << "\t" << lookups / elapsed.count() / 1e6;
+            if (wrong) std::cout << " (" << wrong << " wrong)";
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
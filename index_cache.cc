@@ -0,0 +1,48 @@
+#include "index_cache.h"
+
+std::shared_ptr<const IndexBlock> IndexCache::lookup(uint64_t table,
+                                                     uint64_t block) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = blocks.find(Key(table, block));
+    if (it == blocks.end()) return nullptr;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+}
+
+void IndexCache::insert(uint64_t table, uint64_t block,
+                        std::shared_ptr<const IndexBlock> data) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Key key(table, block);
+    auto it = blocks.find(key);
+    if (it != blocks.end()) evict(it);
+    used += data->bytes();
+    lru.push_front({key, std::move(data)});
+    blocks[key] = lru.begin();
+    // keeps the new block even if it alone exceeds the capacity
+    while (used > capacity && lru.size() > 1)
+        evict(blocks.find(lru.back().first));
+}
+
+void IndexCache::erase(uint64_t table) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = blocks.lower_bound(Key(table, 0));
+    while (it != blocks.end() && it->first.first == table) evict(it++);
+}
+
+void IndexCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    blocks.clear();
+    lru.clear();
+    used = 0;
+}
+
+uint64_t IndexCache::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+void IndexCache::evict(std::map<Key, Lru::iterator>::iterator it) {
+    used -= it->second->second->bytes();
+    lru.erase(it->second);
+    blocks.erase(it);
+}
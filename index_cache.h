@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+
+// A block of INDEX_BLOCK_ENTRIES consecutive entries of an index table, the
+// last block of a table may be shorter
+struct IndexBlock {
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> offsets;
+    uint64_t bytes() const { return (keys.size() + offsets.size()) * 8; }
+};
+
+// The index blocks of released tables, shared by all tables and bounded in
+// bytes. Blocks are keyed by the number of their table and their position in
+// it, the least recently used ones are evicted first.
+class IndexCache {
+   public:
+    IndexCache(uint64_t capacity) : capacity(capacity), used(0) {}
+
+    // the block, or nullptr if it isn't cached
+    std::shared_ptr<const IndexBlock> lookup(uint64_t table, uint64_t block);
+
+    // caches a block and evicts others until the cache fits its capacity
+    void insert(uint64_t table, uint64_t block,
+                std::shared_ptr<const IndexBlock> data);
+
+    // drops the blocks of a deleted table
+    void erase(uint64_t table);
+
+    void clear();
+
+    // the bytes taken by cached blocks
+    uint64_t bytes() const;
+
+   private:
+    typedef std::pair<uint64_t, uint64_t> Key;
+    typedef std::list<std::pair<Key, std::shared_ptr<const IndexBlock>>> Lru;
+
+    uint64_t capacity;
+    uint64_t used;
+    Lru lru;  // from the most recently used block
+    std::map<Key, Lru::iterator> blocks;
+    mutable std::mutex mutex;
+
+    void evict(std::map<Key, Lru::iterator>::iterator it);
+};
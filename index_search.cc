@@ -0,0 +1,125 @@
+#include "index_search.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INDEX_SEARCH_X86
+#endif
+
+namespace {
+
+// the number of keys compared at once at the end of a search
+const size_t WINDOW = 8;
+
+int linearSearch(const uint64_t *keys, size_t n, uint64_t key) {
+    for (size_t i = 0; i < n; i++)
+        if (keys[i] == key) return i;
+    return -1;
+}
+
+// Narrows keys[0, n), n > WINDOW, down to WINDOW keys that hold key if it
+// exists and returns the first of them. The range halves on every step
+// without a branch on the comparison, so there is no misprediction.
+inline const uint64_t *narrow(const uint64_t *keys, size_t n, uint64_t key) {
+    const uint64_t *base = keys;
+    size_t len = n;
+    while (len > WINDOW) {
+        size_t half = len / 2;
+        // both halves may be next, fetches them while the compare resolves
+        __builtin_prefetch(base + half / 2);
+        __builtin_prefetch(base + half + half / 2);
+        base += (base[half - 1] < key) * half;
+        len -= half;
+    }
+    // the window may not pass the end of the array
+    return std::min(base, keys + n - WINDOW);
+}
+
+typedef int (*SearchFunction)(const uint64_t *, size_t, uint64_t);
+
+struct SearchImpl {
+    SearchFunction search;
+    const char *name;
+};
+
+SearchImpl pickImpl() {
+#ifdef INDEX_SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {searchKeysAvx2, "avx2"};
+    if (__builtin_cpu_supports("sse4.2")) return {searchKeysSse, "sse4.2"};
+#endif
+    return {searchKeysScalar, "scalar"};
+}
+
+const SearchImpl impl = pickImpl();
+
+}  // namespace
+
+int searchKeys(const uint64_t *keys, size_t n, uint64_t key) {
+    return impl.search(keys, n, key);
+}
+
+const char *searchKeysImpl() { return impl.name; }
+
+int searchKeysBinary(const uint64_t *keys, size_t n, uint64_t key) {
+    int l = 0;
+    int r = n - 1;
+    while (l <= r) {
+        int mid = (l + r) / 2;
+        if (keys[mid] == key) return mid;
+        if (keys[mid] < key)
+            l = mid + 1;
+        else
+            r = mid - 1;
+    }
+    return -1;
+}
+
+int searchKeysScalar(const uint64_t *keys, size_t n, uint64_t key) {
+    if (n <= WINDOW) return linearSearch(keys, n, key);
+    const uint64_t *w = narrow(keys, n, key);
+    int found = linearSearch(w, WINDOW, key);
+    return found < 0 ? -1 : w - keys + found;
+}
+
+#ifdef INDEX_SEARCH_X86
+
+__attribute__((target("sse4.2"))) int searchKeysSse(const uint64_t *keys,
+                                                     size_t n, uint64_t key) {
+    if (n <= WINDOW) return linearSearch(keys, n, key);
+    const uint64_t *w = narrow(keys, n, key);
+    const __m128i *v = reinterpret_cast<const __m128i *>(w);
+    __m128i k = _mm_set1_epi64x(key);
+    int mask = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i eq = _mm_cmpeq_epi64(_mm_loadu_si128(v + i), k);
+        mask |= _mm_movemask_pd(_mm_castsi128_pd(eq)) << (i * 2);
+    }
+    return mask ? w - keys + __builtin_ctz(mask) : -1;
+}
+
+__attribute__((target("avx2"))) int searchKeysAvx2(const uint64_t *keys,
+                                                    size_t n, uint64_t key) {
+    if (n <= WINDOW) return linearSearch(keys, n, key);
+    const uint64_t *w = narrow(keys, n, key);
+    const __m256i *v = reinterpret_cast<const __m256i *>(w);
+    __m256i k = _mm256_set1_epi64x(key);
+    __m256i lo = _mm256_cmpeq_epi64(_mm256_loadu_si256(v), k);
+    __m256i hi = _mm256_cmpeq_epi64(_mm256_loadu_si256(v + 1), k);
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo)) |
+               _mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4;
+    return mask ? w - keys + __builtin_ctz(mask) : -1;
+}
+
+#else
+
+int searchKeysSse(const uint64_t *keys, size_t n, uint64_t key) {
+    return searchKeysScalar(keys, n, key);
+}
+
+int searchKeysAvx2(const uint64_t *keys, size_t n, uint64_t key) {
+    return searchKeysScalar(keys, n, key);
+}
+
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Finds key in keys[0, n), which is sorted in ascending order, and returns its
+// position or -1. A branchless binary search narrows the range down to a few
+// keys that are then compared at once with AVX2 or SSE4.2 if the cpu has
+// them, the implementation is picked on the first call.
+int searchKeys(const uint64_t *keys, size_t n, uint64_t key);
+
+// the name of the implementation searchKeys uses: avx2, sse4.2 or scalar
+const char *searchKeysImpl();
+
+// The individual implementations, for benchmarks. searchKeysBinary is the
+// plain binary search searchKeys replaces.
+int searchKeysBinary(const uint64_t *keys, size_t n, uint64_t key);
+int searchKeysScalar(const uint64_t *keys, size_t n, uint64_t key);
+int searchKeysSse(const uint64_t *keys, size_t n, uint64_t key);
+int searchKeysAvx2(const uint64_t *keys, size_t n, uint64_t key);
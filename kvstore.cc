@@ -1,46 +1,416 @@
 #include "kvstore.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <map>
 #include <iostream>
+#include <set>
 #include <string>
 #include <vector>
 
 #include "common.h"
 #include "skiplist.h"
 
-KVStore::KVStore(const std::string &dir)
-    : KVStoreAPI(dir), dir(dir), verbose(false), memTableSize(0), level(0) {
+namespace {
+
+// whether name is prefix followed by a number, saved in number; other files
+// left in the folder are skipped
+bool parseNumbered(const std::string &name, const std::string &prefix,
+                   uint64_t *number) {
+    if (name.compare(0, prefix.size(), prefix) != 0) return false;
+    std::string digits = name.substr(prefix.size());
+    // 19 digits always fit in 64 bits
+    if (digits.empty() || digits.size() > 19 ||
+        !std::all_of(digits.begin(), digits.end(),
+                     [](unsigned char c) { return std::isdigit(c); }))
+        return false;
+    *number = std::stoull(digits);
+    return true;
+}
+
+}  // namespace
+
+KVStore::KVStore(const std::string &dir, const Options &options)
+    : KVStoreAPI(dir),
+      dir(dir),
+      options(options),
+      verbose(options.verbose),
+      memTableSize(0),
+      level(0) {
+    policy = newCompactionPolicy(options);
+    int threads = options.maxSubcompactions;
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (options.compactionPool && options.compactionPool->size() > 1)
+        pool = options.compactionPool;
+    else if (!options.compactionPool && threads > 1)
+        pool = std::make_shared<ThreadPool>(threads);
+    if (options.compactionRateLimit > 0)
+        limiter = std::unique_ptr<RateLimiter>(
+            new RateLimiter(options.compactionRateLimit));
+    if (options.indexCacheBytes > 0)
+        indexCache = std::unique_ptr<IndexCache>(
+            new IndexCache(options.indexCacheBytes));
+    if (options.rowCacheBytes > 0)
+        rowCache =
+            std::unique_ptr<RowCache>(new RowCache(options.rowCacheBytes));
+    if (options.valueLogThreshold > 0)
+        valueLog = std::unique_ptr<ValueLog>(new ValueLog(
+            (std::filesystem::path(dir) / "vlog").string(),
+            options.valueLogFileSize));
     memTable = std::unique_ptr<SkipList<uint64_t, std::string>>(
-        new SkipList<uint64_t, std::string>());
+        new SkipList<uint64_t, std::string>(options.memTableHashIndex));
     // this->dir = dir;
     // root = std::filesystem::path(dir);
     fileNum.push_back(0);
+    // the trash of a resetAsync that didn't finish
+    std::vector<std::pair<uint64_t, std::string>> levels;
+    if (std::filesystem::exists(dir)) {
+        for (auto &e : std::filesystem::directory_iterator(dir)) {
+            std::string name = e.path().filename().string();
+            uint64_t number;
+            if (parseNumbered(name, "level-", &number))
+                levels.emplace_back(number, name);
+            if (!parseNumbered(name, "trash-", &number)) continue;
+            trashNumber = std::max(trashNumber, number);
+            reclaim(e.path().string());
+        }
+    }
     loadSsTable();
+    // levels after a missing one were not yet moved to the trash when the
+    // store closed, level 0 goes first
+    std::vector<std::string> stray;
+    for (auto &l : levels)
+        if (l.first >= fileNum.size()) stray.push_back(l.second);
+    if (!stray.empty()) moveToTrash(stray);
+    loadRangeTombstones();
+    // tables written before tables had a sequence are ordered by the times
+    // of their entries, which the sequence carries on from
+    for (auto &t : indexTableList)
+        sequence = std::max(sequence, t.properties.sequence > 0
+                                          ? t.properties.sequence
+                                          : std::max((int64_t)time(nullptr),
+                                                     t.properties.maxTime));
+    if (options.writeAheadLog) {
+        std::filesystem::create_directories(dir);
+        // the writes that didn't reach an ss-table before the store closed:
+        // the logs of memTables sealed for a flush, oldest first, then the
+        // log of the active one
+        std::vector<std::pair<uint64_t, std::string>> sealed;
+        for (auto &e : std::filesystem::directory_iterator(dir)) {
+            uint64_t number;
+            if (parseNumbered(e.path().filename().string(), "wal-", &number))
+                sealed.emplace_back(number, e.path().string());
+        }
+        std::sort(sealed.begin(), sealed.end());
+        auto replay = [this](WriteAheadLog::Op op, uint64_t key,
+                             const std::string &val) { apply(op, key, val); };
+        for (auto &log : sealed) WriteAheadLog(log.second).replay(replay);
+        wal = std::unique_ptr<WriteAheadLog>(new WriteAheadLog(
+            (std::filesystem::path(dir) / "wal").string()));
+        wal->replay(replay);
+        if (sealed.empty()) {
+            maybeFlush();
+        } else {
+            // one table holds all of them before the sealed logs go
+            for (auto &log : sealed) replayedLogs.push_back(log.second);
+            flushMemTable();
+        }
+    }
 }
 
-KVStore::~KVStore() { memTable.release(); }
+KVStore::~KVStore() {
+    // waits for the reads in flight
+    ioPool.reset();
+    // the inputs of an unfinished compaction are still in place
+    cancelCompaction();
+    // the sealed memTables go to level 0, their compaction waits for the
+    // next open; the logs of those that can't be written are replayed then
+    drainFlushes();
+    for (auto &m : immutables) {
+        m->flushed.wait();
+        m->table.release();
+    }
+    // and the trash being deleted
+    reclaimer.reset();
+    memTable.release();
+    if (options.writeBufferManager)
+        options.writeBufferManager->release(chargedBytes);
+}
 
 /**
  * Insert/Update the key-value pair.
  * No return values for simplicity.
  */
 void KVStore::put(uint64_t key, const std::string &s) {
-    std::clog << "+ " << key << " " << std::string(s, 0, 50) << std::endl;
-    memTable->put(key, s);
+    Writer w(WriteAheadLog::PUT, key, &s);
+    write(w);
+}
+
+void KVStore::put(uint64_t key, const std::string &s, uint64_t ttl) {
+    putUntil(key, s, ttl ? (int64_t)time(nullptr) + (int64_t)ttl : 0);
+}
+
+void KVStore::putUntil(uint64_t key, const std::string &s, int64_t expiresAt) {
+    if (expiresAt == 0) {
+        put(key, s);
+        return;
+    }
+    // the log and apply take the expiry before the value
+    std::string val(sizeof(expiresAt), '\0');
+    memcpy(&val[0], &expiresAt, sizeof(expiresAt));
+    val += s;
+    Writer w(WriteAheadLog::PUT_EXPIRING, key, &val);
+    write(w);
+}
+
+void KVStore::write(Writer &w) {
+    std::unique_lock<std::mutex> lock(writeMutex);
+    writers.push_back(&w);
+    while (!w.done && &w != writers.front()) w.cv.wait(lock);
+    if (w.done) return;
+    // w leads the writers queued so far, those queued meanwhile wait for
+    // the next group
+    std::vector<Writer *> group;
+    uint64_t bytes = 0;
+    for (Writer *x : writers) {
+        if (w.task) {
+            group.push_back(x);
+            break;
+        }
+        if (x->task) break;
+        if (!group.empty() && bytes + x->val->length() > MAX_WRITE_GROUP_BYTES)
+            break;
+        group.push_back(x);
+        bytes += x->val->length();
+    }
+    lock.unlock();
+    if (w.task) {
+        w.task();
+    } else {
+        if (wal) {
+            std::string records;
+            for (Writer *x : group)
+                WriteAheadLog::encode(records, x->op, x->key, *x->val);
+            wal->append(records);
+            if (options.syncWrites) wal->sync();
+        }
+        for (Writer *x : group) x->result = apply(x->op, x->key, *x->val);
+        // the memTable may overflow by a group, the log covers all of it
+        maybeFlush();
+        if (options.incrementalCompactionRatio > 0) {
+            uint64_t written = 0;
+            for (Writer *x : group)
+                written += getDataSize(x->val->length());
+            advanceCompaction(written);
+        }
+    }
+    lock.lock();
+    for (Writer *x : group) {
+        writers.pop_front();
+        x->done = true;
+        if (x != &w) x->cv.notify_one();
+    }
+    if (!writers.empty()) writers.front()->cv.notify_one();
+}
+
+bool KVStore::apply(WriteAheadLog::Op op, uint64_t key, const std::string &s) {
+    if (op == WriteAheadLog::DELETE) {
+        bool existed = remove(key);
+        // after the lookup of remove, which may cache the old value
+        if (rowCache) rowCache->erase(key);
+        return existed;
+    }
+    if (op == WriteAheadLog::DELETE_RANGE) {
+        uint64_t end = 0;
+        memcpy(&end, s.data(), std::min(sizeof(end), s.length()));
+        removeRange(key, end);
+        return false;
+    }
+    const std::string *val = &s;
+    std::string value;
+    int64_t expiresAt = 0;
+    if (op == WriteAheadLog::PUT_EXPIRING) {
+        memcpy(&expiresAt, s.data(), std::min(sizeof(expiresAt), s.length()));
+        value = s.substr(std::min(sizeof(expiresAt), s.length()));
+        val = &value;
+    }
+    if (verbose)
+        std::clog << "+ " << key << " " << std::string(*val, 0, 50)
+                  << std::endl;
+    memTable->put(key, *val);
+    if (expiresAt)
+        memTableExpiries[key] = expiresAt;
+    else if (!memTableExpiries.empty())
+        memTableExpiries.erase(key);
+    if (rowCache) rowCache->erase(key);
+    // the expiry takes room in the table as well
     memTableSize += getDataSize(s.length());
-    if (verbose) {
-        // std::clog << "put " << key << '\t' << s << "  done.\n";
-        // std::clog << *memTable << '\n';
+    stats.userBytes += sizeof(key) + val->length();
+    return false;
+}
+
+void KVStore::maybeFlush() {
+    // the tables the flusher has written so far
+    if (installFlushes(false)) maybeCompaction();
+    bool full = memTableSize >= options.memTableBytes;
+    // over the shared budget a memTable goes early, unless it is too small
+    // to be worth a table of its own
+    WriteBufferManager *budget = options.writeBufferManager.get();
+    if (!full && budget && budget->exceeded())
+        full = memTableSize >= options.memTableBytes / 4;
+    if (!full) {
+        chargeWriteBuffer();
+        return;
     }
-    // if the size memTable reaches the threshold, then calls buildSsTable and
-    // resets memTable
-    if (this->memTableSize >= MEM_TABLE_SIZE_MAX) {
-        convertMemTable();
-        resetMemTable();
-        // std::clog << *memTable << std::endl;
+    // the logs replayed on open go with a table written in the foreground
+    if (options.maxImmutableMemTables > 0 && !valueLog &&
+        replayedLogs.empty()) {
+        switchMemTable();
+        // writes stall while too many memTables wait for the flusher
+        bool installed = false;
+        while ((int)immutables.size() > options.maxImmutableMemTables) {
+            stats.flushStalls++;
+            installed = installFlushes(true) || installed;
+        }
+        if (installed) maybeCompaction();
+        return;
     }
+    // a memTable that can't be written stays with its log, the next write
+    // tries again
+    flushMemTable();
+}
+
+void KVStore::switchMemTable() {
+    std::shared_ptr<ImmutableMemTable> m(new ImmutableMemTable);
+    m->table = std::move(memTable);
+    m->expiries.swap(memTableExpiries);
+    m->size = memTableSize;
+    m->writeTime = time(nullptr);
+    m->sequence = ++sequence;
+    std::string number = std::to_string(++sealNumber);
+    std::filesystem::create_directories(resolvePath(-1));
+    m->path =
+        (std::filesystem::path(resolvePath(-1)) / ("flush-" + number)).string();
+    if (wal) {
+        // the log is kept until the table of its memTable is installed
+        std::filesystem::path path = std::filesystem::path(dir) / "wal";
+        m->log = (std::filesystem::path(dir) / ("wal-" + number)).string();
+        wal.reset();
+        std::filesystem::rename(path, m->log);
+        wal = std::unique_ptr<WriteAheadLog>(new WriteAheadLog(path.string()));
+    }
+    submitFlush(m.get());
+    immutables.push_back(m);
+    if (verbose) std::clog << "memTable sealed " << m->path << std::endl;
+    resetMemTable();
+}
+
+void KVStore::submitFlush(ImmutableMemTable *p) {
+    if (!flusher) flusher = std::unique_ptr<ThreadPool>(new ThreadPool(1));
+    // the flusher only reads the memTable, gets may read it meanwhile
+    p->flushed = flusher->submit([this, p] {
+        auto start = std::chrono::steady_clock::now();
+        p->result = writeMemTable(*p->table, p->expiries, p->writeTime,
+                                  p->sequence, p->path, false);
+        p->micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    });
+}
+
+bool KVStore::installFlushes(bool wait) {
+    bool installed = false;
+    while (!immutables.empty()) {
+        ImmutableMemTable &m = *immutables.front();
+        if (!wait && m.flushed.wait_for(std::chrono::seconds(0)) !=
+                         std::future_status::ready)
+            break;
+        // only the oldest one is waited for
+        wait = false;
+        m.flushed.get();
+        stats.flushMicros += m.micros;
+        if (m.result.empty()) {
+            // the newer tables may not go first
+            std::clog << "error writing " << m.path << ", retrying"
+                      << std::endl;
+            m.failures++;
+            submitFlush(&m);
+            break;
+        }
+        installTable(m.result, m.path);
+        if (!m.log.empty()) std::filesystem::remove(m.log);
+        // dropped like resetMemTable drops the memTable
+        m.table.release();
+        immutables.pop_front();
+        installed = true;
+    }
+    if (installed) chargeWriteBuffer();
+    return installed;
+}
+
+bool KVStore::drainFlushes() {
+    while (!immutables.empty()) {
+        installFlushes(true);
+        if (!immutables.empty() &&
+            immutables.front()->failures >= MAX_FLUSH_FAILURES)
+            return false;
+    }
+    return true;
+}
+
+void KVStore::discardFlushes() {
+    std::error_code ec;
+    for (auto &m : immutables) {
+        m->flushed.wait();
+        std::filesystem::remove(m->path, ec);
+        if (!m->log.empty()) std::filesystem::remove(m->log, ec);
+        m->table.release();
+    }
+    immutables.clear();
+    chargeWriteBuffer();
+}
+
+const std::string *KVStore::findInMemory(uint64_t key) const {
+    static const std::string gone;
+    const std::string *val = memTable->get(key);
+    const Expiries *expiries = &memTableExpiries;
+    const ImmutableMemTable *sealed = nullptr;
+    for (auto it = immutables.rbegin(); !val && it != immutables.rend();
+         ++it) {
+        val = (*it)->table->get(key);
+        expiries = &(*it)->expiries;
+        sealed = it->get();
+    }
+    // a range deleted after the memTable was sealed deletes the older
+    // entries of the key as well
+    if (val && sealed && !rangeTombstones.empty() &&
+        sealed->sequence <= rangeDeletedAt(key))
+        return &gone;
+    // an expired entry still hides the older ones of its key
+    if (val && !expiries->empty()) {
+        auto it = expiries->find(key);
+        if (it != expiries->end() && expired(it->second, time(nullptr)))
+            return &gone;
+    }
+    return val;
+}
+
+void KVStore::chargeWriteBuffer() {
+    if (!options.writeBufferManager) return;
+    uint64_t bytes = memTableSize;
+    for (auto &m : immutables) bytes += m->size;
+    if (bytes > chargedBytes)
+        options.writeBufferManager->reserve(bytes - chargedBytes);
+    else
+        options.writeBufferManager->release(chargedBytes - bytes);
+    chargedBytes = bytes;
 }
 
 /**
@@ -50,33 +420,253 @@ void KVStore::put(uint64_t key, const std::string &s) {
  * Looks for key in memTable first, and then in SsTables
  */
 std::string KVStore::get(uint64_t key) {
-    std::clog << "? " << key << std::endl;
-    // looks for key in memTable
-    std::string *strPointer = memTable->get(key);
+    if (verbose) std::clog << "? " << key << std::endl;
+    // looks for key in the memTables
+    const std::string *strPointer = findInMemory(key);
     if (strPointer) {
-        std::clog << "\t[m]->" << std::string(*strPointer, 0, 40) << std::endl;
+        if (verbose)
+            std::clog << "\t[m]->" << std::string(*strPointer, 0, 40)
+                      << std::endl;
         return *strPointer;
     }
+    uint64_t version = 0;
+    if (rowCache) {
+        std::shared_ptr<const std::string> cached = rowCache->lookup(key);
+        if (cached) {
+            stats.rowCacheHits++;
+            return *cached;
+        }
+        version = rowCache->version();
+    }
     // looks for key in SsTables using indexTable
+    stats.gets++;
     uint64_t offset = 0;
     int count = findIndexedKey(key, &offset);
-    bool found = count != -1;
-    // calculate coresponding ssTable level and id
-    // int back = count;
-    int level = 0;
-    while (count - fileNum[level] >= 0) {
-        count -= fileNum[level];
-        level++;
-    }
-    int fileId = count;
-    if (found) {
+    if (count != -1) {
         // reads value on disk according to offest
-        std::clog << "\t@" << level << "-" << fileId << std::endl;
-        return readPair(resolvePath(level, fileId), offset);
+        Location loc = getLocation(count);
+        if (verbose)
+            std::clog << "\t@" << loc.level << "-" << loc.id << std::endl;
+        int64_t expiresAt = 0;
+        std::string val = readPair(resolvePath(loc), offset,
+                                   indexTableList[count].compact,
+                                   deletedAt(indexTableList[count], key),
+                                   &expiresAt);
+        // the cache doesn't know when an entry expires
+        if (rowCache && !val.empty() && !expiresAt)
+            rowCache->insert(key, val, version);
+        return val;
     }
     return "";
 }
 
+PinnedValue KVStore::getPinned(uint64_t key) {
+    if (verbose) std::clog << "? " << key << " pinned" << std::endl;
+    const std::string *strPointer = findInMemory(key);
+    // the memTable changes in place, the value is copied
+    if (strPointer) return PinnedValue(*strPointer);
+    uint64_t version = 0;
+    if (rowCache) {
+        std::shared_ptr<const std::string> cached = rowCache->lookup(key);
+        if (cached) {
+            stats.rowCacheHits++;
+            return PinnedValue(cached->data(), cached->size(), cached);
+        }
+        version = rowCache->version();
+    }
+    stats.gets++;
+    uint64_t offset = 0;
+    int count = findIndexedKey(key, &offset);
+    if (count == -1) return PinnedValue();
+    std::shared_ptr<MappedFile> file = mapTable(count);
+    const char *val = nullptr;
+    uint64_t len = 0;
+    bool indirect = false;
+    int64_t time = 0;
+    int64_t expiresAt = 0;
+    if (!file ||
+        !parseEntry(*file, offset, indexTableList[count].compact, val, len,
+                    indirect, &time, &expiresAt) ||
+        time <= deletedAt(indexTableList[count], key))
+        return PinnedValue();
+    if (indirect) {
+        if (!valueLog) return PinnedValue();
+        std::string p(val, len);
+        PinnedValue value(valueLog->read(decodePointer(p)));
+        if (rowCache && !value.empty() && !expiresAt)
+            rowCache->insert(key, value.toString(), version);
+        return value;
+    }
+    // the cache keeps a copy, the value stays pinned in the table
+    if (rowCache && len > 0 && !expiresAt)
+        rowCache->insert(key, std::string(val, len), version);
+    return PinnedValue(val, len, file);
+}
+
+void KVStore::getAsync(uint64_t key,
+                       std::function<void(const std::string &)> done) {
+    if (verbose) std::clog << "? " << key << " async" << std::endl;
+    const std::string *strPointer = findInMemory(key);
+    if (strPointer) {
+        done(*strPointer);
+        return;
+    }
+    uint64_t version = 0;
+    if (rowCache) {
+        std::shared_ptr<const std::string> cached = rowCache->lookup(key);
+        if (cached) {
+            stats.rowCacheHits++;
+            done(*cached);
+            return;
+        }
+        version = rowCache->version();
+    }
+    // the index lookup stays on the calling thread, only the read of the
+    // entry goes to an io thread
+    stats.gets++;
+    uint64_t offset = 0;
+    int count = findIndexedKey(key, &offset);
+    std::shared_ptr<MappedFile> file;
+    if (count != -1) file = mapTable(count);
+    if (!file) {
+        done("");
+        return;
+    }
+    if (!ioPool)
+        ioPool = std::unique_ptr<ThreadPool>(
+            new ThreadPool(std::max(1, options.ioThreads)));
+    const ValueLog *log = valueLog.get();
+    int64_t deleted = deletedAt(indexTableList[count], key);
+    // the store waits for the io threads before the cache goes
+    RowCache *cache = rowCache.get();
+    bool compact = indexTableList[count].compact;
+    ioPool->submit([file, offset, compact, log, deleted, done, cache, key,
+                    version] {
+        const char *val = nullptr;
+        uint64_t len = 0;
+        bool indirect = false;
+        int64_t time = 0;
+        int64_t expiresAt = 0;
+        std::string value;
+        if (!parseEntry(*file, offset, compact, val, len, indirect, &time,
+                        &expiresAt) ||
+            time <= deleted)
+            value = "";
+        else if (indirect)
+            value = log ? log->read(decodePointer(std::string(val, len))) : "";
+        else
+            value = std::string(val, len);
+        if (cache && !value.empty() && !expiresAt)
+            cache->insert(key, value, version);
+        done(value);
+    });
+}
+
+void KVStore::putAsync(uint64_t key, const std::string &s,
+                       std::function<void()> done) {
+    put(key, s);
+    done();
+}
+
+bool KVStore::parseEntry(const MappedFile &file, uint64_t offset,
+                         bool compact, const char *&val, uint64_t &len,
+                         bool &indirect, int64_t *time, int64_t *expiresAt) {
+    int64_t t = 0;
+    if (compact) {
+        uint64_t delta = 0;
+        if (offset > file.size()) return false;
+        val = parseCompactHeader(file.data() + offset,
+                                 file.data() + file.size(), delta, t, len,
+                                 indirect);
+        if (!val) return false;
+    } else {
+        if (offset + 24 > file.size()) return false;
+        memcpy(&t, file.data() + offset + 8, sizeof(t));
+        memcpy(&len, file.data() + offset + 16, sizeof(len));
+        indirect = len & VALUE_POINTER;
+        len &= ~VALUE_POINTER;
+        if (offset + 24 + len > file.size()) return false;
+        val = file.data() + offset + 24;
+    }
+    int64_t expiry = takeExpiry(t, val, len);
+    if (expired(expiry, std::time(nullptr))) {
+        len = 0;
+        indirect = false;
+    }
+    if (time) *time = t;
+    if (expiresAt) *expiresAt = expiry;
+    return true;
+}
+
+std::shared_ptr<MappedFile> KVStore::mapTable(int index) {
+    uint64_t number = indexTableList[index].number;
+    auto it = mappedTables.find(number);
+    if (it != mappedTables.end()) return it->second;
+    std::shared_ptr<MappedFile> file =
+        MappedFile::open(resolvePath(getLocation(index)));
+    if (file) mappedTables[number] = file;
+    return file;
+}
+
+void KVStore::scan(uint64_t key1, uint64_t key2,
+                   std::list<std::pair<uint64_t, std::string>> &list) {
+    if (verbose) std::clog << "? [" << key1 << ", " << key2 << "]" << std::endl;
+    // the first entry seen of a key is the newest one: the memTable comes
+    // and the immutable ones first, then the tables from level 0 down
+    std::map<uint64_t, std::string> entries;
+    // an expired entry hides the older ones of its key like a deletion
+    int64_t now = time(nullptr);
+    // a sealed memTable is deleted by the ranges deleted after it was sealed
+    auto scanMemory = [&](const SkipList<uint64_t, std::string> &table,
+                          const Expiries &expiries, int64_t sealed) {
+        table.scan(key1, key2, [&](uint64_t key, const std::string &val) {
+            auto it = expiries.find(key);
+            if ((it != expiries.end() && expired(it->second, now)) ||
+                (sealed > 0 && !rangeTombstones.empty() &&
+                 sealed <= rangeDeletedAt(key)))
+                entries.emplace(key, "");
+            else
+                entries.emplace(key, val);
+        });
+    };
+    scanMemory(*memTable, memTableExpiries, 0);
+    for (auto it = immutables.rbegin(); it != immutables.rend(); ++it)
+        scanMemory(*(*it)->table, (*it)->expiries, (*it)->sequence);
+    for (size_t i = 0; i < indexTableList.size(); i++) {
+        const IndexTable &t = indexTableList[i];
+        if (t.empty() || t.maxKey() < key1 || t.minKey() > key2) continue;
+        // only the part of the range the table covers may hold keys
+        if (!t.filter.mayContain(std::max(key1, t.minKey()),
+                                 std::min(key2, t.maxKey()))) {
+            stats.filterSkips++;
+            continue;
+        }
+        stats.scanTableReads++;
+        std::string path = resolvePath(getLocation(i));
+        for (auto &p : readSsTable(path, t, key1, key2)) {
+            if (entries.count(p.key)) continue;
+            // older entries of the key are deleted by the range as well
+            if ((!rangeTombstones.empty() && p.time <= deletedAt(t, p.key)) ||
+                expired(p.expiresAt, now)) {
+                entries.emplace(p.key, "");
+                continue;
+            }
+            if (p.indirect)
+                p.val = valueLog ? valueLog->read(decodePointer(p.val)) : "";
+            entries.emplace(p.key, p.val);
+        }
+    }
+    // deleted keys are empty
+    for (auto &e : entries)
+        if (e.second != "") list.push_back(e);
+}
+
+std::vector<std::string> KVStore::multiGet(const std::vector<uint64_t> &keys) {
+    std::vector<std::string> values;
+    for (uint64_t key : keys) values.push_back(get(key));
+    return values;
+}
+
 /**
  * Delete the given key-value pair if it exists.
  * Returns false iff the key is not found.
@@ -88,16 +678,144 @@ std::string KVStore::get(uint64_t key) {
  * If it's not found, the function returns false.
  */
 bool KVStore::del(uint64_t key) {
-    std::clog << "- " << key << std::endl;
+    std::string empty;
+    Writer w(WriteAheadLog::DELETE, key, &empty);
+    write(w);
+    return w.result;
+}
+
+void KVStore::deleteRange(uint64_t start, uint64_t end) {
+    if (start > end) return;
+    std::string last(sizeof(end), '\0');
+    memcpy(&last[0], &end, sizeof(end));
+    Writer w(WriteAheadLog::DELETE_RANGE, start, &last);
+    write(w);
+}
+
+void KVStore::removeRange(uint64_t start, uint64_t end) {
+    if (verbose)
+        std::clog << "- [" << start << ", " << end << "]" << std::endl;
+    // the sealed memTables are older than the tombstone and stay as they are
+    std::vector<uint64_t> keys;
+    memTable->scan(start, end, [&](uint64_t key, const std::string &) {
+        keys.push_back(key);
+    });
+    std::shared_ptr<std::string> val(new std::string);
+    for (uint64_t key : keys) {
+        if (!memTable->remove(key, val)) continue;
+        memTableSize -= getDataSize(val->length());
+        if (memTableExpiries.erase(key)) memTableSize -= sizeof(int64_t);
+    }
+    if (rowCache) rowCache->erase(start, end);
+    // the tombstone covers every table written so far and none written
+    // later; replaying the log may record the same range again
+    RangeTombstone t = {start, end, ++sequence};
+    addRangeTombstone(t);
+    appendRangeTombstone(t);
+}
+
+void KVStore::addRangeTombstone(const RangeTombstone &t) {
+    // cuts the fragment holding key so that one starts at key
+    auto cut = [this](uint64_t key) {
+        auto it = rangeTombstones.upper_bound(key);
+        if (it == rangeTombstones.begin()) return;
+        RangeTombstone &f = (--it)->second;
+        if (f.start == key || f.end < key) return;
+        rangeTombstones[key] = {key, f.end, f.sequence};
+        f.end = key - 1;
+    };
+    cut(t.start);
+    if (t.end < UINT64_MAX) cut(t.end + 1);
+    // the fragments inside the range now, and the gaps between them
+    uint64_t next = t.start;
+    bool done = false;
+    auto it = rangeTombstones.lower_bound(t.start);
+    for (; it != rangeTombstones.end() && it->first <= t.end; ++it) {
+        if (next < it->first)
+            rangeTombstones[next] = {next, it->first - 1, t.sequence};
+        it->second.sequence = std::max(it->second.sequence, t.sequence);
+        done = it->second.end == UINT64_MAX;
+        next = it->second.end + 1;
+    }
+    if (!done && next <= t.end)
+        rangeTombstones[next] = {next, t.end, t.sequence};
+}
+
+int64_t KVStore::rangeDeletedAt(uint64_t key) const {
+    auto it = rangeTombstones.upper_bound(key);
+    if (it == rangeTombstones.begin()) return -1;
+    --it;
+    return key <= it->second.end ? it->second.sequence : -1;
+}
+
+int64_t KVStore::deletedAt(const IndexTable &table, uint64_t key) const {
+    int64_t seq = rangeDeletedAt(key);
+    if (table.properties.sequence == 0) return seq;
+    return table.properties.sequence <= seq ? INT64_MAX : -1;
+}
+
+void KVStore::loadRangeTombstones() {
+    std::ifstream fs((std::filesystem::path(dir) / "range-tombstones").string(),
+                     std::ios::binary);
+    RangeTombstone t;
+    // a record torn by a crash is cut off
+    while (fs.read(reinterpret_cast<char *>(&t.start), 8) &&
+           fs.read(reinterpret_cast<char *>(&t.end), 8) &&
+           fs.read(reinterpret_cast<char *>(&t.sequence), 8)) {
+        addRangeTombstone(t);
+        sequence = std::max(sequence, t.sequence);
+    }
+}
+
+void KVStore::appendRangeTombstone(const RangeTombstone &t) const {
+    std::filesystem::create_directories(dir);
+    std::string path =
+        (std::filesystem::path(dir) / "range-tombstones").string();
+    bool created = !std::filesystem::exists(path);
+    uint64_t record[3] = {t.start, t.end, (uint64_t)t.sequence};
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0 || ::write(fd, record, sizeof(record)) != sizeof(record))
+        std::clog << "error writing " << path << std::endl;
+    if (fd >= 0 && options.syncTables) fdatasync(fd);
+    if (fd >= 0) close(fd);
+    if (created && options.syncTables) syncDir(dir);
+}
+
+void KVStore::saveRangeTombstones() const {
+    std::string buf;
+    for (auto &f : rangeTombstones) {
+        const RangeTombstone &t = f.second;
+        buf.append(reinterpret_cast<const char *>(&t.start), 8);
+        buf.append(reinterpret_cast<const char *>(&t.end), 8);
+        buf.append(reinterpret_cast<const char *>(&t.sequence), 8);
+    }
+    std::filesystem::create_directories(dir);
+    std::filesystem::path path(dir);
+    std::string tmp = (path / "range-tombstones.tmp").string();
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ssize_t n = fd < 0 ? -1 : ::write(fd, buf.data(), buf.length());
+    if (n != (ssize_t)buf.length())
+        std::clog << "error writing " << tmp << std::endl;
+    if (fd >= 0 && options.syncTables) fdatasync(fd);
+    if (fd >= 0) close(fd);
+    // replaces the old file at once
+    std::filesystem::rename(tmp, path / "range-tombstones");
+    if (options.syncTables) syncDir(dir);
+}
+
+bool KVStore::remove(uint64_t key) {
+    if (verbose) std::clog << "- " << key << std::endl;
     std::string val = get(key);
     bool exists = false;
     std::shared_ptr<std::string> strVal(new std::string);
 
     uint64_t offset = 0;
-    // exists in some ssTable
-    if (findIndexedKey(key, &offset) != -1) {
+    // exists in some ssTable or an immutable memTable
+    bool older = false;
+    for (auto &m : immutables) older = older || m->table->get(key);
+    if (older || findIndexedKey(key, &offset) != -1) {
         if (val != "") {
-            put(key, "");
+            apply(WriteAheadLog::PUT, key, "");
             exists = true;
         }else {
             exists = false;
@@ -105,10 +823,12 @@ bool KVStore::del(uint64_t key) {
         // std::clog << "\tindexed" << std::endl;
     } else if (memTable->remove(key, strVal)) {
         this->memTableSize -= getDataSize((*strVal).length());
-        exists = true;
-        std::clog << "\tin mem" << std::endl;
+        if (memTableExpiries.erase(key)) memTableSize -= sizeof(int64_t);
+        // an expired entry is gone already
+        exists = val != "";
+        if (verbose) std::clog << "\tin mem" << std::endl;
     }
-    if (!exists) std::clog << "x" << std::endl;
+    if (!exists && verbose) std::clog << "x" << std::endl;
     return exists;
 }
 
@@ -117,6 +837,10 @@ bool KVStore::del(uint64_t key) {
  * including memtable and all sstables files.
  */
 void KVStore::reset() {
+    // waits for the reads in flight, they may read the value log
+    ioPool.reset();
+    cancelCompaction();
+    discardFlushes();
     // reset memTable
     resetMemTable();
     // Removes all existing ss-table
@@ -125,65 +849,368 @@ void KVStore::reset() {
     while (std::filesystem::exists(level)) {
         // std::clog << "remove " << level << std::endl;
         uintmax_t count = std::filesystem::remove_all(level);
-        std::clog << "removed " << count << " file or directories" << std::endl;
+        if (verbose)
+            std::clog << "removed " << count << " file or directories"
+                      << std::endl;
         level = resolvePath(++lv);
         // std::clog << level << std::endl;
     }
     level = resolvePath(-1);
     if (std::filesystem::exists(level)) std::filesystem::remove_all(level);
     indexTableList.clear();
+    if (indexCache) indexCache->clear();
+    if (rowCache) rowCache->clear();
+    mappedTables.clear();
     fileNum.clear();
     fileNum.push_back(0);
+    policy = newCompactionPolicy(options);
+    if (valueLog) valueLog->reset();
+    if (wal) wal->reset();
+    rangeTombstones.clear();
+    std::filesystem::remove(std::filesystem::path(dir) / "range-tombstones");
 }
 
-void KVStore::convertMemTable() {
-    // get pointer to the head of linked list from SkipList. Beware that the
-    // last non-nullptr pointer would be the tail, which contains no meaningful
-    // data
-    std::shared_ptr<typename SkipList<uint64_t, std::string>::Node> p =
-        memTable->exportData();
-    // while ((p = p->succ) && memTable->valid(p)) std::clog << p->key << "\n";
+bool KVStore::ingestFiles(const std::vector<std::string> &paths) {
+    // the placement below looks at the levels as they are
+    finishCompaction();
+    if (!drainFlushes()) return false;
+    // tables that overlap no level go to the last one, with leveled
+    // compaction to one whose target holds all of them, which spares
+    // compaction from pushing them down level by level
+    uint64_t total = 0;
+    std::error_code ec;
+    for (auto &path : paths) total += std::filesystem::file_size(path, ec);
+    int bottom = 1;
+    if (options.compactionStyle == CompactionStyle::Leveled) {
+        uint64_t target = options.levelBaseBytes;
+        for (; target < total; bottom++) target *= options.levelMultiplier;
+    }
+    for (auto &path : paths) {
+        IndexTable t = loadIndex(path);
+        if (t.empty()) {
+            std::clog << "error reading " << path << std::endl;
+            return false;
+        }
+        // the memTable is newer than any table
+        bool overlaps = false;
+        memTable->scan(t.minKey(), t.maxKey(),
+                       [&](uint64_t, const std::string &) { overlaps = true; });
+        if (overlaps && !flushMemTable()) return false;
+        // the deepest level with no overlap in it and the levels above;
+        // level 0 holds tables of any range
+        int lv = std::max(bottom, (int)fileNum.size() - 1);
+        for (int i = 0; i < (int)fileNum.size(); i++) {
+            bool overlap = false;
+            for (int j = 0; j < fileNum[i]; j++) {
+                const IndexTable &o = indexTableList[getIndex(i, j)];
+                if (o.minKey() <= t.maxKey() && t.minKey() <= o.maxKey())
+                    overlap = true;
+            }
+            if (!overlap) continue;
+            lv = std::max(0, i - 1);
+            break;
+        }
+        if ((int)fileNum.size() <= lv) fileNum.resize(lv + 1, 0);
+        for (int i = -1; i <= lv; i++)
+            std::filesystem::create_directories(resolvePath(i));
+        int pos = 0;
+        if (lv > 0)
+            while (pos < fileNum[lv] &&
+                   indexTableList[getIndex(lv, pos)].maxKey() < t.minKey())
+                pos++;
+        // the file is moved into the temporary folder first, or copied if
+        // it is on another file system
+        std::string moving =
+            (std::filesystem::path(resolvePath(-1)) / "ingesting").string();
+        std::filesystem::rename(path, moving, ec);
+        bool copied = (bool)ec;
+        if (copied &&
+            !std::filesystem::copy_file(
+                path, moving, std::filesystem::copy_options::overwrite_existing,
+                ec)) {
+            std::clog << "error moving " << path << std::endl;
+            return false;
+        }
+        // the table is newer than the ranges deleted so far; it is stamped
+        // in the store's copy, the caller's file stays as it was
+        if (TableBuilder::writeSequence(moving, sequence + 1,
+                                        options.syncTables)) {
+            t.properties.sequence = ++sequence;
+        } else {
+            // an older table is ordered by the time SstWriter stamped all
+            // its entries with, a table without properties is read for it
+            int64_t time = t.properties.maxTime;
+            bool indirect = false;
+            if (!t.properties.present)
+                readEntry(moving, 0, t.compact, &indirect, &time);
+            for (auto &f : rangeTombstones) {
+                const RangeTombstone &r = f.second;
+                if (r.end < t.minKey() || r.start > t.maxKey() ||
+                    r.sequence < time)
+                    continue;
+                std::clog << "range tombstone newer than " << path
+                          << std::endl;
+                // hands the file back
+                if (copied)
+                    std::filesystem::remove(moving, ec);
+                else
+                    std::filesystem::rename(moving, path, ec);
+                return false;
+            }
+            sequence = std::max(sequence, time);
+        }
+        std::vector<int> from;
+        for (int i = 0; i < fileNum[lv]; i++) {
+            if (i == pos) from.push_back(-1);
+            from.push_back(i);
+        }
+        if (pos == fileNum[lv]) from.push_back(-1);
+        renameLevel(lv, from);
+        std::filesystem::rename(moving, resolvePath(lv, pos));
+        if (options.syncTables) syncDir(resolvePath(lv));
+        if (verbose)
+            std::clog << path << " -> " << resolvePath(lv, pos) << std::endl;
+        admitTable(t, lv);
+        indexTableList.insert(indexTableList.begin() + getIndex(lv, pos), t);
+        fileNum[lv]++;
+        // the table may hold newer values of cached keys
+        if (rowCache) rowCache->erase(t.minKey(), t.maxKey());
+        stats.ingestBytes += t.size;
+    }
+    maybeCompaction();
+    return true;
+}
+
+void KVStore::resetAsync() {
+    // waits for the reads in flight, they may read the value log
+    ioPool.reset();
+    cancelCompaction();
+    // the flusher writes to tmp, which moves to the trash
+    discardFlushes();
+    resetMemTable();
+    std::vector<std::string> names;
+    if (std::filesystem::exists(dir)) {
+        for (auto &e : std::filesystem::directory_iterator(dir)) {
+            std::string name = e.path().filename().string();
+            if (name.rfind("level-", 0) == 0 || name == "tmp" ||
+                name == "vlog" || name == "range-tombstones")
+                names.push_back(name);
+        }
+    }
+    // a store opened without level 0 moves the other levels away as well
+    std::sort(names.begin(), names.end(), [](const std::string &a,
+                                             const std::string &b) {
+        return (a == "level-0") > (b == "level-0");
+    });
+    if (!names.empty()) moveToTrash(names);
+    indexTableList.clear();
+    if (indexCache) indexCache->clear();
+    if (rowCache) rowCache->clear();
+    mappedTables.clear();
+    fileNum.clear();
+    fileNum.push_back(0);
+    policy = newCompactionPolicy(options);
+    // the folder is gone, only a new active file is created
+    if (valueLog) valueLog->reset();
+    if (wal) wal->reset();
+    rangeTombstones.clear();
+}
+
+void KVStore::moveToTrash(const std::vector<std::string> &names) {
+    std::filesystem::path trash =
+        std::filesystem::path(dir) / ("trash-" + std::to_string(++trashNumber));
+    std::filesystem::create_directories(trash);
+    for (auto &name : names)
+        std::filesystem::rename(std::filesystem::path(dir) / name,
+                                trash / name);
+    if (options.syncTables) syncDir(dir);
+    reclaim(trash.string());
+}
+
+void KVStore::reclaim(const std::string &trash) {
+    if (!reclaimer)
+        reclaimer = std::unique_ptr<ThreadPool>(new ThreadPool(1));
+    reclaimer->submit([trash] {
+        std::error_code ec;
+        std::filesystem::remove_all(trash, ec);
+    });
+}
+
+bool KVStore::convertMemTable() {
+    // the sealed memTables are older and go first
+    if (!drainFlushes()) return false;
+    std::filesystem::create_directories(resolvePath(-1));
+    // the table is written to the temporary folder and only moved to level 0
+    // once it is complete and synced
+    std::string tmp =
+        (std::filesystem::path(resolvePath(-1)) / "flush").string();
+    auto start = std::chrono::steady_clock::now();
+    IndexTable table =
+        writeMemTable(*memTable, memTableExpiries, time(nullptr), ++sequence,
+                      tmp, true);
+    stats.flushMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    if (table.empty()) {
+        std::clog << "error writing " << tmp << std::endl;
+        return false;
+    }
+    installTable(table, tmp);
+    maybeCompaction();
+    return true;
+}
+
+bool KVStore::flushMemTable() {
+    if (!convertMemTable()) return false;
+    resetMemTable();
+    // the table holds the writes of the logs now
+    if (wal) wal->reset();
+    for (auto &log : replayedLogs) std::filesystem::remove(log);
+    replayedLogs.clear();
+    return true;
+}
+
+void KVStore::installTable(IndexTable &table, const std::string &tmp) {
     std::string lv = resolvePath(0);
     std::string filename = resolvePath(0, 0);
     std::filesystem::create_directories(lv);
-    renameLevel(0, 0);
-    std::fstream fs(filename, std::ios::out | std::ios::binary);
-    // prepares the cache for index data
-    std::vector<Index> indexTable;
-    uint64_t offset = 0;
-    // writes the data segment
-    while ((p = p->succ) && memTable->valid(p)) {
-        // std::clog << "write key = " << p->key << std::endl;
-        // convert to char * on demand
-        uint64_t strLen = p->val.length();
-        time_t writeTime = time(nullptr);
-        Entry e(p->key, writeTime, strLen, p->val);
-        writeEntry(fs, e);
-        // caches index data
-        indexTable.push_back(Index(p->key, offset));
-        offset += sizeof(p->key) + sizeof(writeTime) + sizeof(strLen) +
-                  p->val.length();
-    }
-    // writes index data to file
-    for (auto i : indexTable) {
-        // std::clog << "write key: " << i.key << " offset: " << i.offset
-        //   << " tellp: " << fs.tellp() << std::endl;
-        fs.write(reinterpret_cast<char *>(&i.key), sizeof(i.key));
-        fs.write(reinterpret_cast<char *>(&i.offset), sizeof(i.offset));
-    }
-    // writes meta data
-    // index of indexTable
-    // std::clog << "Meta: offset = " << std::hex << "0x" << offset << std::dec
-    //   << std::endl;
-    fs.write(reinterpret_cast<char *>(&offset), sizeof(offset));
-    indexTableList.insert(indexTableList.begin(), indexTable);
-    fs.close();
-    renameLevel(0, 1);
-    std::clog << "memTable -> " << filename << std::endl;
+    admitTable(table, 0);
+    // the new table takes id 0 and the existing ones shift by one
+    std::vector<int> from(1, -1);
+    for (int i = 0; i < fileNum[0]; i++) from.push_back(i);
+    renameLevel(0, from);
+    std::filesystem::rename(tmp, filename);
+    if (options.syncTables) syncDir(lv);
+    indexTableList.insert(indexTableList.begin(), table);
+    if (verbose) std::clog << "memTable -> " << filename << std::endl;
     // update state
     fileNum[0]++;
-    // compaction if the number of files in level 0 is more than 2
-    if (fileNum[0] > 2) compaction();
+    stats.flushBytes += table.size;
+}
+
+IndexTable KVStore::writeMemTable(SkipList<uint64_t, std::string> &table,
+                                  const Expiries &expiries, int64_t writeTime,
+                                  int64_t sequence, const std::string &path,
+                                  bool separate) {
+    // get pointer to the head of linked list from SkipList. Beware that the
+    // last non-nullptr pointer would be the tail, which contains no meaningful
+    // data
+    std::shared_ptr<typename SkipList<uint64_t, std::string>::Node> p =
+        table.exportData();
+    TableBuilder builder(path, options.tableWriteBuffer, false, nullptr,
+                         options.learnedIndexError, options.compactTables,
+                         options.pipelinedFlush);
+    builder.setSequence(sequence);
+    separate = separate && valueLog;
+    int64_t now = time(nullptr);
+    while ((p = p->succ) && table.valid(p)) {
+        int64_t expiresAt = 0;
+        if (!expiries.empty()) {
+            auto it = expiries.find(p->key);
+            if (it != expiries.end()) expiresAt = it->second;
+        }
+        if (expired(expiresAt, now)) {
+            // still hides the older entries of the key
+            builder.add(p->key, writeTime, "");
+        } else if (separate && p->val.length() >= options.valueLogThreshold) {
+            // the table only keeps where the value is
+            ValuePointer vp = valueLog->append(p->key, p->val);
+            stats.valueLogBytes += 16 + p->val.length();
+            builder.add(p->key, writeTime, encodePointer(vp), true, expiresAt);
+        } else
+            builder.add(p->key, writeTime, p->val, false, expiresAt);
+    }
+    // the values must be durable before a table points to them
+    if (separate && options.syncTables) valueLog->sync();
+    return builder.finish(options.syncTables);
+}
+
+bool KVStore::createCheckpoint(const std::string &target) {
+    bool ok = false;
+    Writer w([&] { ok = writeCheckpoint(target); });
+    write(w);
+    return ok;
+}
+
+namespace {
+
+// hard-links from to to, or copies it if that fails
+bool linkOrCopy(const std::filesystem::path &from,
+                const std::filesystem::path &to) {
+    std::error_code ec;
+    std::filesystem::create_hard_link(from, to, ec);
+    if (ec) std::filesystem::copy_file(from, to, ec);
+    if (ec) std::clog << "error copying " << from << std::endl;
+    return !ec;
+}
+
+}  // namespace
+
+bool KVStore::writeCheckpoint(const std::string &target) {
+    std::filesystem::path to(target);
+    std::error_code ec;
+    if (std::filesystem::exists(to) && !std::filesystem::is_empty(to, ec)) {
+        std::clog << target << " is not empty" << std::endl;
+        return false;
+    }
+    // every level folder, a store stops loading at the first missing one
+    for (size_t lv = 0; lv < fileNum.size(); lv++)
+        std::filesystem::create_directories(to /
+                                            ("level-" + std::to_string(lv)));
+    // the memTable and the sealed ones go first in level 0, newest first,
+    // with their values in place since the value log may be linked already
+    std::vector<std::tuple<SkipList<uint64_t, std::string> *,
+                           const Expiries *, int64_t, int64_t>>
+        memory;
+    if (memTableSize > 0)
+        memory.emplace_back(memTable.get(), &memTableExpiries, time(nullptr),
+                            ++sequence);
+    for (auto it = immutables.rbegin(); it != immutables.rend(); ++it)
+        memory.emplace_back((*it)->table.get(), &(*it)->expiries,
+                            (*it)->writeTime, (*it)->sequence);
+    int first = 0;
+    for (auto &m : memory) {
+        std::string path =
+            (to / "level-0" / ("sstable-" + std::to_string(first))).string();
+        if (writeMemTable(*std::get<0>(m), *std::get<1>(m), std::get<2>(m),
+                          std::get<3>(m), path, false)
+                .empty()) {
+            std::clog << "error writing " << path << std::endl;
+            return false;
+        }
+        first++;
+    }
+    bool ok = true;
+    for (size_t lv = 0; lv < fileNum.size(); lv++) {
+        std::filesystem::path level = to / ("level-" + std::to_string(lv));
+        for (int id = 0; id < fileNum[lv]; id++) {
+            int copy = lv == 0 ? id + first : id;
+            ok = ok && linkOrCopy(resolvePath(lv, id),
+                                  level / ("sstable-" + std::to_string(copy)));
+        }
+        if (options.syncTables) syncDir(level.string());
+    }
+    // what the tables point to is in the files now; the active one is
+    // sealed first, a link to it would share the values appended later
+    std::filesystem::path vlog = std::filesystem::path(dir) / "vlog";
+    if (valueLog && std::filesystem::exists(vlog)) {
+        valueLog->seal();
+        std::filesystem::create_directories(to / "vlog");
+        for (uint64_t file : valueLog->sealedFiles()) {
+            std::string name = "vlog-" + std::to_string(file);
+            ok = ok && linkOrCopy(vlog / name, to / "vlog" / name);
+        }
+        if (options.syncTables) syncDir((to / "vlog").string());
+    }
+    // rewritten on every change, so it is copied
+    std::filesystem::path tombstones =
+        std::filesystem::path(dir) / "range-tombstones";
+    if (std::filesystem::exists(tombstones)) {
+        std::filesystem::copy_file(tombstones, to / "range-tombstones", ec);
+        if (ec) ok = false;
+    }
+    if (options.syncTables) syncDir(target);
+    return ok;
 }
 
 void KVStore::loadSsTable() {
@@ -199,7 +1226,7 @@ void KVStore::loadSsTable() {
         while (std::filesystem::exists(filename)) {
             // std::clog << "see file " << filename << std::endl;
             // parse the file
-            readSsTable(filename);
+            readSsTable(filename, lv);
             fileNum[lv]++;
             filename = resolvePath(lv, ++count);
         }
@@ -208,118 +1235,287 @@ void KVStore::loadSsTable() {
     }
 }
 
-void KVStore::readSsTable(std::string path) {
+void KVStore::readSsTable(std::string path, int level) {
     // load index table into indexTableList
-    std::ifstream fs(path, std::ios::binary);
-    // std::clog << "read ss table from " << path << std::endl;
-    // reads the offest of the begining of the index part
-    if (!fs.is_open()) {
-        // std::clog << "Error open file " << path << std::endl;
+    IndexTable table = loadIndex(path);
+    admitTable(table, level);
+    indexTableList.push_back(table);
+}
+
+void KVStore::admitTable(IndexTable &table, int level) {
+    if (table.number == 0) table.number = ++tableNumber;
+    // compaction builds the filters of its output while writing it
+    if (options.rangeFilterBitsPerKey > 0 && table.filter.empty() &&
+        table.resident())
+        table.filter =
+            RangeFilter::build(table.keys, options.rangeFilterBitsPerKey);
+    if (level < options.pinnedIndexLevels) return;
+    bool model = options.learnedIndexError > 0 && !table.model.empty();
+    if (model || indexCache) table.release();
+}
+
+namespace {
+
+// decodes n entries of the index blocks of a compact table at p, a block
+// starts at every INDEX_BLOCK_ENTRIES entries; false if they pass end
+bool decodeIndexBlocks(const char *p, const char *end, uint64_t n,
+                       std::vector<uint64_t> &keys,
+                       std::vector<uint64_t> &offsets) {
+    uint64_t key = 0, offset = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t k = 0, o = 0;
+        if (!(p = getVarint(p, end, k)) || !(p = getVarint(p, end, o)))
+            return false;
+        key = i % INDEX_BLOCK_ENTRIES ? key + k : k;
+        offset = i % INDEX_BLOCK_ENTRIES ? offset + o : o;
+        keys.push_back(key);
+        offsets.push_back(offset);
     }
-    fs.seekg(-8, std::ios::end);
-    uint64_t offset = 0;
-    fs.read(reinterpret_cast<char *>(&offset), sizeof(offset));
-    // std::clog << "read: get offset of index table at " << std::hex << offset
-    //           << std::dec << std::endl;
-    // reads keys and indices and saves them in indexTable
-    fs.seekg(offset);
-    std::vector<Index> indexTable;
-    while (!fs.eof()) {
-        uint64_t key = 0;
-        uint64_t off = 0;
-        // int64_t time = 0;
-        fs.read(reinterpret_cast<char *>(&key), sizeof(key));
-        // fs.read(reinterpret_cast<char *>(&time), sizeof(time));
-        fs.read(reinterpret_cast<char *>(&off), sizeof(off));
-        if (fs.gcount() == 0)
-            break;  // if fs comes to meta data then break, this condition may
-                    // fail if the meta data changes
-        // std::clog << "read key: " << key << std::hex << " @0x" << off << " "
-        // << std::dec << fs.gcount() << std::endl;
-        indexTable.push_back(Index(key, off));
+    return true;
+}
+
+}  // namespace
+
+IndexTable KVStore::loadIndex(const std::string &path) const {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return IndexTable({}, {}, 0, 0);
+    uint64_t size = lseek(fd, 0, SEEK_END);
+    // the properties block follows the footer, the rest is read up to end
+    TableProperties props;
+    uint64_t end = TableBuilder::readProperties(fd, size, props);
+    // the meta data: the offset of the index table, preceded by the magic
+    // number and the model if the table has one
+    uint64_t footer[2] = {0, 0};
+    if (end >= 16) pread(fd, footer, sizeof(footer), end - 16);
+    else if (end >= 8) pread(fd, footer + 1, 8, end - 8);
+    uint64_t indexOffset = footer[1];
+    if (footer[0] == TableBuilder::COMPACT_MAGIC) {
+        // the blocks, their offsets and the number of entries
+        uint64_t entries = 0;
+        if (end >= 24) pread(fd, &entries, sizeof(entries), end - 24);
+        uint64_t blocks =
+            (entries + INDEX_BLOCK_ENTRIES - 1) / INDEX_BLOCK_ENTRIES;
+        uint64_t indexEnd = end - 24 - blocks * 8;
+        std::vector<uint64_t> keys, offsets;
+        std::string buf;
+        if (end >= 24 + blocks * 8 && indexOffset <= indexEnd) {
+            buf.resize(indexEnd - indexOffset);
+            if (pread(fd, &buf[0], buf.size(), indexOffset) !=
+                    (ssize_t)buf.size() ||
+                !decodeIndexBlocks(buf.data(), buf.data() + buf.size(),
+                                   entries, keys, offsets)) {
+                keys.clear();
+                offsets.clear();
+            }
+        }
+        close(fd);
+        IndexTable table(keys, offsets, indexOffset, size);
+        table.compact = true;
+        table.footerEnd = end;
+        table.properties = props;
+        return table;
     }
-    fs.close();
-    // for(auto i: indexTable) {
-    //     std::clog << "key " << i.key << "offset "
-    // }
-    indexTableList.push_back(indexTable);
+    uint64_t indexEnd = end < 8 ? 0 : end - 8;
+    LinearModel model;
+    uint64_t meta[2] = {0, 0};  // the number of segments and the error
+    if (footer[0] == TableBuilder::MODEL_MAGIC && end >= 32 &&
+        pread(fd, meta, sizeof(meta), end - 32) == sizeof(meta) &&
+        meta[0] * 24 + 32 <= end - indexOffset) {
+        std::string m(meta[0] * 24 + 16, '\0');
+        uint64_t modelOffset = end - 16 - m.length();
+        if (pread(fd, &m[0], m.length(), modelOffset) == (ssize_t)m.length()) {
+            model = LinearModel::decode(m);
+            indexEnd = modelOffset;
+        }
+    }
+    // reads keys and offsets at once
+    uint64_t entries = 0;
+    if (indexEnd > indexOffset) entries = (indexEnd - indexOffset) / 16;
+    std::vector<uint64_t> buf(entries * 2);
+    ssize_t n = pread(fd, buf.data(), entries * 16, indexOffset);
+    if (n != (ssize_t)(entries * 16)) entries = 0;
+    close(fd);
+    std::vector<uint64_t> keys(entries);
+    std::vector<uint64_t> offsets(entries);
+    for (uint64_t i = 0; i < entries; i++) {
+        keys[i] = buf[i * 2];
+        offsets[i] = buf[i * 2 + 1];
+    }
+    IndexTable table(keys, offsets, indexOffset, size, model);
+    table.footerEnd = end;
+    table.properties = props;
+    return table;
 }
 
-std::vector<Pair> KVStore::readSsTable(int level, int id) {
-    std::vector<Pair> table;
-    std::string path = resolvePath(level, id);
+std::vector<Pair> KVStore::readSsTable(const std::string &path,
+                                       const IndexTable &table, uint64_t min,
+                                       uint64_t max) const {
+    std::vector<Pair> pairs;
+    if (!table.resident())
+        return readSsTable(path, loadIndex(path), min, max);
+    const std::vector<uint64_t> &keys = table.keys;
+    size_t first =
+        std::lower_bound(keys.begin(), keys.end(), min) - keys.begin();
+    size_t last =
+        std::upper_bound(keys.begin() + first, keys.end(), max) - keys.begin();
+    if (first == last) return pairs;
+    uint64_t begin = table.offsets[first];
+    uint64_t end = last == keys.size() ? table.dataEnd() : table.offsets[last];
     std::ifstream fs(path, std::ios::binary);
-    // std::clog << "read ss table from " << path << std::endl;
     if (!fs.is_open()) {
         // std::clog << "error read sstable " << path << std::endl;
-        return table;
+        return pairs;
     }
-    fs.seekg(-8, std::ios::end);
-    uint64_t offset = 0;
-    fs.read(reinterpret_cast<char *>(&offset), sizeof(offset));
-    // std::clog << "read: offset of index table at " << std::hex << offset
-    //           << std::dec << std::endl;
-
-    fs.seekg(std::ios::beg);
-    while (fs.tellg() < (int64_t)offset) {
-        // std::clog << "fs pos: " << fs.tellg() << std::endl;
+    // reads the whole range at once and parses it in memory
+    std::vector<char> buf(end - begin);
+    fs.seekg(begin);
+    fs.read(buf.data(), buf.size());
+    fs.close();
+    const char *p = buf.data();
+    const char *bufEnd = buf.data() + buf.size();
+    for (size_t i = first; table.compact && i != last; i++) {
+        // the keys come from the index, the deltas are skipped
+        uint64_t delta = 0, len = 0;
+        int64_t time = 0;
+        bool indirect = false;
+        const char *val =
+            parseCompactHeader(p, bufEnd, delta, time, len, indirect);
+        if (!val) break;
+        p = val + len;
+        int64_t expiresAt = takeExpiry(time, val, len);
+        pairs.push_back(Pair(keys[i], time, std::string(val, len), indirect,
+                             expiresAt));
+    }
+    for (size_t i = first; !table.compact && i != last; i++) {
         uint64_t key = 0;
         uint64_t len = 0;
-        time_t time = 0;
-        fs.read(reinterpret_cast<char *>(&key), sizeof(key));
-        fs.read(reinterpret_cast<char *>(&time), sizeof(time));
-        fs.read(reinterpret_cast<char *>(&len), sizeof(len));
-        char *tmp = new char[len + 1];
-        fs.read(tmp, len);
-        tmp[len] = '\0';
-        std::string val(tmp);
-        delete[] tmp;
-        table.push_back(Pair(key, time, val));
+        int64_t time = 0;
+        memcpy(&key, p, sizeof(key));
+        memcpy(&time, p + 8, sizeof(time));
+        memcpy(&len, p + 16, sizeof(len));
+        bool indirect = len & VALUE_POINTER;
+        len &= ~VALUE_POINTER;
+        const char *val = p + 24;
+        p += 24 + len;
+        int64_t expiresAt = takeExpiry(time, val, len);
+        pairs.push_back(
+            Pair(key, time, std::string(val, len), indirect, expiresAt));
     }
-    fs.close();
-    // for (auto i : table)
-    // std::clog << "key " << i.key << "\tval " << std::string(i.val, 0, 50)
-    // << std::endl;
+    return pairs;
+}
 
-    return table;
+int KVStore::findIndexedKey(uint64_t key, uint64_t *offsetDst) {
+    uint64_t offset = 0;
+    for (size_t i = 0; i < indexTableList.size(); i++) {
+        const IndexTable &indexTable = indexTableList[i];
+        // skips tables whose key range doesn't cover the key
+        if (indexTable.empty() || key < indexTable.minKey() ||
+            key > indexTable.maxKey())
+            continue;
+        if (!indexTable.filter.mayContain(key, key)) {
+            stats.filterSkips++;
+            continue;
+        }
+        stats.tableProbes++;
+        if (indexTable.resident()) {
+            int pos = indexTable.find(key);
+            if (pos < 0) continue;
+            offset = indexTable.offsets[pos];
+        } else if (options.learnedIndexError > 0 && !indexTable.model.empty()) {
+            if (!searchModel(resolvePath(getLocation(i)), indexTable, key,
+                             &offset))
+                continue;
+        } else if (!searchBlock(i, key, &offset))
+            continue;
+        if (offsetDst != nullptr) *offsetDst = offset;
+        return i;
+    }
+    return -1;
 }
 
-void KVStore::writeEntry(std::fstream &fs, Entry &e) {
-    if (!fs.is_open()) {
-        // std::clog << "Error open file" << std::endl;
-        return;
+bool KVStore::searchBlock(int index, uint64_t key, uint64_t *offset) {
+    const IndexTable &table = indexTableList[index];
+    // the fences are the first keys of the blocks
+    uint64_t block = std::upper_bound(table.fences.begin(), table.fences.end(),
+                                      key) -
+                     table.fences.begin() - 1;
+    std::shared_ptr<const IndexBlock> data =
+        indexCache->lookup(table.number, block);
+    if (data) {
+        stats.indexCacheHits++;
+    } else {
+        stats.indexCacheMisses++;
+        data = readIndexBlock(resolvePath(getLocation(index)), table, block);
+        if (!data) return false;
+        indexCache->insert(table.number, block, data);
     }
-    fs.write(reinterpret_cast<char *>(&e.key), sizeof(e.key));
-    fs.write(reinterpret_cast<char *>(&e.timestamp), sizeof(e.timestamp));
-    fs.write(reinterpret_cast<char *>(&e.len), sizeof(e.len));
-    fs.write(e.str.c_str(), e.len);  // write val
+    int pos = searchKeys(data->keys.data(), data->keys.size(), key);
+    if (pos < 0) return false;
+    *offset = data->offsets[pos];
+    return true;
 }
 
-int KVStore::findIndexedKey(uint64_t key, uint64_t *offsetDst) const {
-    int count = 0;
-    bool found = false;
-    uint64_t offset = 0;
-    for (auto table : indexTableList) {
-        if (found) break;
-        // binary searches in an index table
-        int l = 0;
-        int r = table.size() - 1;
-        while (l <= r) {
-            int mid = (l + r) / 2;
-            if (table[mid].key == key) {
-                offset = table[mid].offset;
-                found = true;
-                break;
-            }
-            if (table[mid].key < key) {
-                l = mid + 1;
-            } else
-                r = mid - 1;
+std::shared_ptr<const IndexBlock> KVStore::readIndexBlock(
+    const std::string &path, const IndexTable &table, uint64_t block) const {
+    uint64_t first = block * INDEX_BLOCK_ENTRIES;
+    uint64_t n = std::min(INDEX_BLOCK_ENTRIES, table.entries - first);
+    std::vector<uint64_t> buf(n * 2);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    if (table.compact) {
+        // the offsets of this block and the next one from the start of the
+        // index, the last block ends where the offsets start
+        uint64_t blocks = table.fences.size();
+        uint64_t dir = table.footerEnd - 24 - blocks * 8;
+        uint64_t range[2] = {0, dir - table.indexOffset};
+        ssize_t want = block + 1 < blocks ? 16 : 8;
+        std::string data;
+        bool ok = pread(fd, range, want, dir + block * 8) == want &&
+                  range[0] <= range[1];
+        if (ok) {
+            data.resize(range[1] - range[0]);
+            ok = pread(fd, &data[0], data.size(),
+                       table.indexOffset + range[0]) == (ssize_t)data.size();
+        }
+        close(fd);
+        std::shared_ptr<IndexBlock> decoded(new IndexBlock);
+        if (!ok || !decodeIndexBlocks(data.data(), data.data() + data.size(),
+                                      n, decoded->keys, decoded->offsets))
+            return nullptr;
+        return decoded;
+    }
+    ssize_t done =
+        pread(fd, buf.data(), n * 16, table.indexOffset + first * 16);
+    close(fd);
+    if (done != (ssize_t)(n * 16)) return nullptr;
+    std::shared_ptr<IndexBlock> data(new IndexBlock);
+    for (uint64_t i = 0; i < n; i++) {
+        data->keys.push_back(buf[i * 2]);
+        data->offsets.push_back(buf[i * 2 + 1]);
+    }
+    return data;
+}
+
+bool KVStore::searchModel(const std::string &path, const IndexTable &table,
+                          uint64_t key, uint64_t *offset) const {
+    uint64_t first = 0;
+    uint64_t last = 0;
+    table.model.predict(key, table.entries, first, last);
+    if (first >= last) return false;
+    // reads only the index entries within the error of the model
+    std::vector<uint64_t> buf((last - first) * 2);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    ssize_t n = pread(fd, buf.data(), buf.size() * 8,
+                      table.indexOffset + first * 16);
+    close(fd);
+    for (size_t i = 0; i * 16 + 16 <= (size_t)std::max(n, (ssize_t)0); i++) {
+        if (buf[i * 2] == key) {
+            *offset = buf[i * 2 + 1];
+            return true;
         }
-        if (!found) count++;
     }
-    if (found && offsetDst != nullptr) *offsetDst = offset;
-    return found ? count : -1;
+    return false;
 }
 
 std::string KVStore::resolvePath(int level, int id) const {
@@ -335,222 +1531,616 @@ std::string KVStore::resolvePath(int level) const {
     return std::filesystem::path(root / lv).string();
 }
 
-std::string KVStore::resolvePath(Location &l) const {
+std::string KVStore::resolvePath(const Location &l) const {
     return resolvePath(l.level, l.id);
 }
 
-std::string KVStore::readPair(std::string path, uint64_t offset) {
-    std::ifstream fs(path, std::ios::binary);
-    uint64_t len = 0;
-    // 16 = key + time
-    fs.seekg(offset + 16);
-    fs.read(reinterpret_cast<char *>(&len), sizeof(len));
-    char *tmp = new char[len + 1];
-    fs.read(tmp, len);
-    fs.close();
-    tmp[len] = '\0';
-    std::string val(tmp);
-    delete[] tmp;
+std::string KVStore::readPair(std::string path, uint64_t offset,
+                              bool compact, int64_t deletedAt,
+                              int64_t *expiresAt) {
+    bool indirect = false;
+    int64_t time = 0;
+    std::string val =
+        readEntry(path, offset, compact, &indirect, &time, expiresAt);
+    if (time <= deletedAt) return "";
+    if (indirect) return valueLog ? valueLog->read(decodePointer(val)) : "";
     // std::clog << "read " << len << " byte: " << val << std::endl;
     return val;
 }
 
+std::string KVStore::readEntry(const std::string &path, uint64_t offset,
+                               bool compact, bool *indirect, int64_t *time,
+                               int64_t *expiresAt) const {
+    std::ifstream fs(path, std::ios::binary);
+    uint64_t len = 0;
+    int64_t t = 0;
+    if (compact) {
+        // the header takes at most three varints
+        char header[3 * MAX_VARINT_BYTES];
+        fs.seekg(offset);
+        fs.read(header, sizeof(header));
+        uint64_t delta = 0;
+        const char *end = header + fs.gcount();
+        const char *p = getVarint(header, end, delta);
+        uint64_t u = 0;
+        if (p) p = getVarint(p, end, u);
+        if (p) p = getVarint(p, end, len);
+        if (!p) return "";
+        t = (int64_t)u;
+        *indirect = len & 1;
+        len >>= 1;
+        fs.clear();
+        fs.seekg(offset + (p - header));
+    } else {
+        // 8 = key
+        fs.seekg(offset + 8);
+        fs.read(reinterpret_cast<char *>(&t), sizeof(t));
+        fs.read(reinterpret_cast<char *>(&len), sizeof(len));
+        *indirect = len & VALUE_POINTER;
+        len &= ~VALUE_POINTER;
+    }
+    std::string val(len, '\0');
+    fs.read(&val[0], len);
+    if ((uint64_t)fs.gcount() != len) return "";
+    const char *v = val.data();
+    int64_t expiry = takeExpiry(t, v, len);
+    if (time) *time = t;
+    if (expiresAt) *expiresAt = expiry;
+    if (expired(expiry, std::time(nullptr))) {
+        *indirect = false;
+        return "";
+    }
+    return expiry ? val.substr(sizeof(expiry)) : val;
+}
+
 void KVStore::resetMemTable() {
     // resets memTable
     memTable.release();
     memTable = std::unique_ptr<SkipList<uint64_t, std::string>>(
-        new SkipList<uint64_t, std::string>());
+        new SkipList<uint64_t, std::string>(options.memTableHashIndex));
     // reset state
+    memTableExpiries.clear();
     memTableSize = 0;
+    chargeWriteBuffer();
 }
 
-void KVStore::writeSsTable(std::vector<Pair> table, Location loc, bool tmp) {
-    std::string path = resolvePath(loc.level, loc.id);
-    std::string folder = resolvePath(loc.level);
-    if (!std::filesystem::exists(folder))
-        std::filesystem::create_directories(folder);
-    std::fstream fs(path, std::ios::out | std::ios::binary);
-    if (!fs.is_open()) {
-        // std::clog << "[writeSsTable] Failed to open sstable file " << path
-        // << std::endl;
-        return;
+IndexTable KVStore::writeSsTable(const std::vector<Pair> &table,
+                                 int64_t sequence,
+                                 const std::string &path) const {
+    TableBuilder builder(path, options.tableWriteBuffer,
+                         options.directIOForCompaction, limiter.get(),
+                         options.learnedIndexError, options.compactTables);
+    builder.setSequence(sequence);
+    // keeps the original timestamp of the entries
+    for (auto &p : table)
+        builder.add(p.key, p.time, p.val, p.indirect, p.expiresAt);
+    IndexTable t = builder.finish(options.syncTables);
+    if (options.rangeFilterBitsPerKey > 0)
+        t.filter = RangeFilter::build(t.keys, options.rangeFilterBitsPerKey);
+    return t;
+}
+
+LevelView KVStore::levelView() const {
+    LevelView levels(fileNum.size());
+    for (size_t lv = 0; lv < fileNum.size(); lv++)
+        for (int i = 0; i < fileNum[lv]; i++)
+            levels[lv].push_back(&indexTableList[getIndex(lv, i)]);
+    return levels;
+}
+
+uint64_t KVStore::sizeOnDisk() const {
+    uint64_t bytes = 0;
+    for (auto &t : indexTableList) bytes += t.size;
+    if (valueLog) bytes += valueLog->size();
+    return bytes;
+}
+
+uint64_t KVStore::indexMemoryBytes() const {
+    uint64_t bytes = 0;
+    for (auto &t : indexTableList) bytes += t.memoryBytes();
+    return bytes;
+}
+
+uint64_t KVStore::cachedIndexBytes() const {
+    return indexCache ? indexCache->bytes() : 0;
+}
+
+uint64_t KVStore::cachedRowBytes() const {
+    return rowCache ? rowCache->bytes() : 0;
+}
+
+bool KVStore::garbageCollectValueLog() {
+    if (!valueLog) return false;
+    std::vector<uint64_t> files = valueLog->sealedFiles();
+    if (files.empty()) return false;
+    uint64_t file = files.front();
+    // a record is live if the newest entry of its key still points to it
+    std::vector<Pair> live;
+    valueLog->scan(file, [&](uint64_t key, const ValuePointer &p,
+                             const std::string &val) {
+        if (findInMemory(key)) return;
+        uint64_t offset = 0;
+        int count = findIndexedKey(key, &offset);
+        if (count == -1) return;
+        bool indirect = false;
+        int64_t time = 0;
+        int64_t expiresAt = 0;
+        std::string entry = readEntry(resolvePath(getLocation(count)), offset,
+                                      indexTableList[count].compact,
+                                      &indirect, &time, &expiresAt);
+        if (indirect && decodePointer(entry) == p &&
+            time > deletedAt(indexTableList[count], key))
+            live.push_back(Pair(key, time, val, false, expiresAt));
+    });
+    if (verbose)
+        std::clog << "vlog gc " << file << ": " << live.size() << " live"
+                  << std::endl;
+    // live values move to the newest file when they are flushed again
+    for (auto &p : live) {
+        putUntil(p.key, p.val, p.expiresAt);
+        stats.userBytes -= sizeof(p.key) + p.val.length();
     }
-    // prepares the cache for index data
-    std::vector<Index> indexTable;
-    uint64_t offset = 0;
-    // writes the data segment
-    for (auto &p : table) {
-        uint64_t strLen = p.val.length();
-        time_t writeTime = time(nullptr);
-        Entry e(p.key, writeTime, strLen, p.val);
-        writeEntry(fs, e);
-        // caches index data
-        indexTable.push_back(Index(p.key, offset));
-        offset +=
-            sizeof(p.key) + sizeof(writeTime) + sizeof(strLen) + p.val.length();
-    }
-    // writes index data to file
-    for (auto i : indexTable) {
-        // std::clog << "write key = " << i.key << " offset = " << i.offset
-        // << std::endl;
-        fs.write(reinterpret_cast<char *>(&i.key), sizeof(i.key));
-        fs.write(reinterpret_cast<char *>(&i.offset), sizeof(i.offset));
-    }
-    // writes meta data
-    // index of indexTable
-    // std::clog << "Meta: offset = " << std::hex << "0x" << offset << std::dec
-    // << std::endl;
-    fs.write(reinterpret_cast<char *>(&offset), sizeof(offset));
-    fs.close();
-    // update state
-    indexTableList.insert(indexTableList.begin() + getIndex(loc), indexTable);
-    if ((int)fileNum.size() <= loc.level) fileNum.push_back(0);
-    if (loc.level >= 0) fileNum[loc.level]++;
-    std::clog << "write ss table done -> " << path << std::endl;
+    // the file may only go once no table points into it
+    if (memTableSize > 0 && !flushMemTable()) return false;
+    valueLog->remove(file);
+    return true;
+}
+
+void KVStore::maybeCompaction() {
+    auto start = std::chrono::steady_clock::now();
+    if (options.incrementalCompactionRatio > 0) {
+        // the writes carry the merge work out
+        pickCompaction();
+    } else {
+        CompactionTask task;
+        while (policy->pick(levelView(), task)) compaction(task);
+    }
+    stats.compactionMicros +=
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+}
+
+void KVStore::compaction(const CompactionTask &task) {
+    std::unique_ptr<CompactionJob> job = startCompaction(task, false);
+    if (!job) return;
+    std::vector<Location> inputs = locateInputs(*job);
+    if (job->subs.size() == 1) {
+        runSubcompaction(inputs, job->bottom, job->subs[0]);
+    } else {
+        std::vector<std::future<void>> done;
+        for (auto &sub : job->subs)
+            done.push_back(pool->submit([this, &inputs, &job, &sub] {
+                runSubcompaction(inputs, job->bottom, sub);
+            }));
+        for (auto &f : done) f.get();
+    }
+    installCompaction(*job);
+}
+
+std::unique_ptr<KVStore::CompactionJob> KVStore::startCompaction(
+    const CompactionTask &task, bool sliced) {
+    int outLv = task.outputLevel;
+    if (verbose)
+        std::clog << "run compaction of " << task.inputs.size()
+                  << " tables into level " << outLv << std::endl;
+    // creates the folders of skipped levels as well, loadSsTable stops at the
+    // first missing one
+    if ((int)fileNum.size() <= outLv) fileNum.resize(outLv + 1, 0);
+    for (int lv = -1; lv <= outLv; lv++)
+        std::filesystem::create_directories(resolvePath(lv));
+    const Location &src = task.inputs[0];
+    if (task.inputs.size() == 1 && src.level != outLv) {
+        const IndexTable &t = indexTableList[getIndex(src)];
+        int pos = 0;
+        while (pos < fileNum[outLv] &&
+               indexTableList[getIndex(outLv, pos)].maxKey() < t.minKey())
+            pos++;
+        trivialMove(src, outLv, pos);
+        return nullptr;
+    }
+    std::unique_ptr<CompactionJob> job(new CompactionJob);
+    job->task = task;
+    for (auto &l : task.inputs)
+        job->inputs.push_back(indexTableList[getIndex(l)].number);
+    // deleted entries can be dropped when no older entry could be shadowed
+    job->bottom = true;
+    for (size_t lv = outLv + 1; lv < fileNum.size(); lv++)
+        if (fileNum[lv] > 0) job->bottom = false;
+    // large compactions are split into key ranges merged in parallel, or
+    // one after another by the writes
+    uint64_t inputBytes = 0;
+    for (auto &l : task.inputs) inputBytes += indexTableList[getIndex(l)].size;
+    const uint64_t slice = 2 * options.tableBytes;
+    int n = pool ? pool->size() : 1;
+    n = std::max(1, std::min(n, (int)(inputBytes / slice)));
+    if (sliced) n = std::max((uint64_t)1, (inputBytes + slice - 1) / slice);
+    std::vector<uint64_t> bounds = subcompactionBounds(task.inputs, n);
+    job->subs.resize(bounds.size());
+    // the output is older than a range deleted while the job runs, whose
+    // entries the subcompactions that run later drop themselves
+    int64_t seq = ++sequence;
+    for (size_t i = 0; i < bounds.size(); i++) {
+        job->subs[i].id = i;
+        job->subs[i].sequence = seq;
+        job->subs[i].min = bounds[i];
+        job->subs[i].max =
+            i + 1 < bounds.size() ? bounds[i + 1] - 1 : UINT64_MAX;
+    }
+    job->sliceBytes = inputBytes / bounds.size();
+    return job;
+}
+
+std::vector<Location> KVStore::locateInputs(const CompactionJob &job) const {
+    std::vector<Location> inputs;
+    for (uint64_t number : job.inputs)
+        for (size_t i = 0; i < indexTableList.size(); i++)
+            if (indexTableList[i].number == number) {
+                inputs.push_back(getLocation(i));
+                break;
+            }
+    return inputs;
 }
 
-void KVStore::compaction(int level) {
-    std::clog << "run compaction on level " << level << std::endl;
+void KVStore::installCompaction(CompactionJob &job) {
+    int outLv = job.task.outputLevel;
+    // gives up and leaves the inputs in place if any output failed
+    bool failed = false;
+    for (auto &sub : job.subs)
+        for (auto &t : sub.tables)
+            if (t.empty()) failed = true;
+    if (failed) {
+        std::clog << "error writing compaction output" << std::endl;
+        for (auto &sub : job.subs)
+            for (auto &path : sub.paths) std::filesystem::remove(path);
+        return;
+    }
+    std::vector<Location> inputs = locateInputs(job);
     // range statistics
-    int nextLv = level + 1;
-    int nextLvPos = -1;        // index of insertion point of indexTable in next
-                               // level, -1 indicates no assignment yet
-    std::vector<Location> id;  // location of tables to be merged
     uint64_t min = UINT64_MAX;
-    uint64_t max = 0;
-    if (level == 0) {
-        uint64_t t0Min = indexTableList[0].front().key;
-        uint64_t t1Min = indexTableList[1].front().key;
-        uint64_t t0Max = indexTableList[0].back().key;
-        uint64_t t1Max = indexTableList[1].back().key;
-        uint64_t t2Min = indexTableList[2].front().key;
-        uint64_t t2Max = indexTableList[2].back().key;
-        min = std::min({t0Min, t1Min, t2Min});
-        max = std::max({t0Max, t1Max, t2Max});
-        // std::clog << "[lv0]compaction range " << min << " " << max <<
-        // std::endl;
-        id.push_back(Location(0, 2));
-        id.push_back(Location(0, 1));
-        id.push_back(Location(0, 0));
-    } else {
-        // selects exceeding files and merges them into next level
-        int more = fileNum[level] - levelSizeLim(level);
-        // counts the range of keys in the last file of current level
-        for (int i = 0; i < more; i++) {
-            int tabId = getIndex(level, levelSizeLim(level) + i);
-            uint64_t tMin = indexTableList[tabId].front().key;
-            uint64_t tMax = indexTableList[tabId].back().key;
-            if (tMin < min) min = tMin;
-            max = tMax > max ? tMax : max;
-            id.push_back(Location(level, levelSizeLim(level) + i));
-        }
-    }
-    // looks for key range overlapped files
-    int delFiles = 0;
-    for (int i = 0; fileNum.size() > (size_t)nextLv && i < fileNum[nextLv];
-         i++) {
-        int tabId = getIndex(nextLv, i);
-        uint64_t tMin = indexTableList[tabId].front().key;
-        uint64_t tMax = indexTableList[tabId].back().key;
-        if (!(tMax < min || max < tMin)) {
-            id.push_back(Location(nextLv, i));
-            delFiles++;
-            // if (nextLvPos == -1) nextLvPos = i;
-        }
-        if (tMax < min) nextLvPos = i + 1;
+    for (auto &l : inputs)
+        min = std::min(min, indexTableList[getIndex(l)].minKey());
+    // tables of the output level that stay, and where the output goes
+    std::vector<int> kept;
+    for (int i = 0; i < fileNum[outLv]; i++) {
+        bool input = false;
+        for (auto &l : inputs)
+            if (l.level == outLv && l.id == i) input = true;
+        if (!input) kept.push_back(i);
+    }
+    int pos = 0;
+    while (pos < (int)kept.size() &&
+           indexTableList[getIndex(outLv, kept[pos])].maxKey() < min)
+        pos++;
+    // update state: removes indexTable from memory, updates fileNum
+    // tables are removed from the back so that earlier indices stay valid
+    std::sort(inputs.begin(), inputs.end(),
+              [this](const Location &a, const Location &b) {
+                  return getIndex(a) > getIndex(b);
+              });
+    for (auto &l : inputs) {
+        int i = getIndex(l);
+        if (indexCache) indexCache->erase(indexTableList[i].number);
+        // pinned values keep their own reference to the mapping
+        mappedTables.erase(indexTableList[i].number);
+        indexTableList.erase(indexTableList.begin() + i);
+        if (!std::filesystem::remove(resolvePath(l)))
+            std::clog << "error deleting " << resolvePath(l) << std::endl;
+    }
+    for (auto &l : inputs) fileNum[l.level]--;
+    // renumbers the remaining tables of the input levels
+    for (int lv = 0; lv < (int)fileNum.size(); lv++) {
+        if (lv == outLv) continue;
+        std::vector<int> from;
+        int n = fileNum[lv];
+        for (auto &l : inputs)
+            if (l.level == lv) n++;
+        for (int i = 0; i < n; i++) {
+            bool input = false;
+            for (auto &l : inputs)
+                if (l.level == lv && l.id == i) input = true;
+            if (!input) from.push_back(i);
+        }
+        if ((int)from.size() != n) renameLevel(lv, from);
+    }
+    // leaves room for the output in the output level, and moves the output
+    // tables of all ranges in key order
+    int outputs = 0;
+    for (auto &sub : job.subs) outputs += sub.paths.size();
+    std::vector<int> from(kept.begin(), kept.begin() + pos);
+    for (int i = 0; i < outputs; i++) from.push_back(-1);
+    from.insert(from.end(), kept.begin() + pos, kept.end());
+    renameLevel(outLv, from);
+    for (auto &sub : job.subs) {
+        for (size_t i = 0; i < sub.paths.size(); i++) {
+            std::filesystem::rename(sub.paths[i], resolvePath(outLv, pos));
+            admitTable(sub.tables[i], outLv);
+            indexTableList.insert(
+                indexTableList.begin() + getIndex(outLv, pos), sub.tables[i]);
+            fileNum[outLv]++;
+            pos++;
+        }
+        stats.compactionBytesRead += sub.bytesRead;
+        stats.compactionBytesWritten += sub.bytesWritten;
+        stats.expiredEntries += sub.expired;
     }
+    if (options.syncTables) syncDir(resolvePath(outLv));
+    stats.compactions++;
+    dropRangeTombstones();
+}
+
+void KVStore::dropRangeTombstones() {
+    if (rangeTombstones.empty()) return;
+    int64_t sealed = INT64_MAX;
+    for (auto &m : immutables) sealed = std::min(sealed, m->sequence);
+    // the fragments a table may hold deleted entries of: the table is no
+    // newer than them, a table without a sequence by the time of its oldest
+    // entry
+    std::set<uint64_t> kept;
+    for (auto &t : indexTableList) {
+        if (t.empty()) continue;
+        int64_t oldest = t.properties.sequence > 0 ? t.properties.sequence
+                         : t.properties.present    ? t.properties.minTime
+                                                   : 0;
+        auto it = rangeTombstones.upper_bound(t.minKey());
+        if (it != rangeTombstones.begin()) --it;
+        for (; it != rangeTombstones.end() && it->first <= t.maxKey(); ++it)
+            if (it->second.end >= t.minKey() && oldest <= it->second.sequence)
+                kept.insert(it->first);
+    }
+    bool dropped = false;
+    for (auto it = rangeTombstones.begin(); it != rangeTombstones.end();) {
+        if (it->second.sequence >= sealed || kept.count(it->first)) {
+            ++it;
+            continue;
+        }
+        it = rangeTombstones.erase(it);
+        dropped = true;
+    }
+    if (!dropped) return;
+    if (verbose)
+        std::clog << rangeTombstones.size() << " range tombstones left"
+                  << std::endl;
+    saveRangeTombstones();
+}
+
+void KVStore::advanceCompaction(uint64_t bytes) {
+    auto start = std::chrono::steady_clock::now();
+    compactionCredit += bytes * options.incrementalCompactionRatio;
+    // writes outpacing compaction would pile up tables in level 0, which
+    // slows gets down for good, a slow write is the lesser evil
+    int trigger = options.compactionStyle == CompactionStyle::Tiered
+                      ? options.tieredRunTrigger
+                      : options.l0CompactionTrigger;
+    if (fileNum[0] >= 4 * trigger) finishCompaction();
+    pickCompaction();
+    CompactionJob *job = pendingCompaction.get();
+    // a slice may outgrow two tables when few keys split the input, the
+    // credit must still be able to pay for it
+    uint64_t cap = 2 * options.tableBytes;
+    if (job) cap = std::max(cap, job->sliceBytes);
+    compactionCredit = std::min(compactionCredit, cap);
+    if (job && compactionCredit >= job->sliceBytes) {
+        compactionCredit -= job->sliceBytes;
+        runSubcompaction(locateInputs(*job), job->bottom,
+                         job->subs[job->next++]);
+    }
+    if (job && job->next == job->subs.size()) {
+        installCompaction(*job);
+        pendingCompaction.reset();
+        pickCompaction();
+    }
+    stats.compactionMicros +=
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+}
+
+void KVStore::pickCompaction() {
+    CompactionTask task;
+    while (!pendingCompaction && policy->pick(levelView(), task))
+        pendingCompaction = startCompaction(task, true);
+}
+
+void KVStore::finishCompaction() {
+    while (pendingCompaction) {
+        CompactionJob &job = *pendingCompaction;
+        while (job.next < job.subs.size())
+            runSubcompaction(locateInputs(job), job.bottom,
+                             job.subs[job.next++]);
+        installCompaction(job);
+        pendingCompaction.reset();
+        // finishes the compactions the install triggers as well
+        if (options.incrementalCompactionRatio > 0) pickCompaction();
+    }
+}
+
+void KVStore::cancelCompaction() {
+    if (!pendingCompaction) return;
+    std::error_code ec;
+    for (auto &sub : pendingCompaction->subs)
+        for (auto &path : sub.paths) std::filesystem::remove(path, ec);
+    pendingCompaction.reset();
+    compactionCredit = 0;
+}
+
+std::vector<uint64_t> KVStore::subcompactionBounds(
+    const std::vector<Location> &inputs, int n) const {
+    std::vector<uint64_t> bounds(1, 0);
+    if (n <= 1) return bounds;
+    // samples some index entries of each table together with the number of
+    // bytes from them to the next sample
+    std::vector<std::pair<uint64_t, uint64_t>> samples;
+    uint64_t total = 0;
+    for (auto &l : inputs) {
+        const IndexTable *table = &indexTableList[getIndex(l)];
+        // a released table is read into a local copy
+        IndexTable loaded({}, {}, 0, 0);
+        if (!table->resident()) {
+            loaded = loadIndex(resolvePath(l));
+            table = &loaded;
+        }
+        const IndexTable &t = *table;
+        size_t entries = t.keys.size();
+        size_t step = std::max((size_t)1, entries / (n * 8));
+        for (size_t i = 0; i < entries; i += step) {
+            uint64_t next =
+                i + step < entries ? t.offsets[i + step] : t.dataEnd();
+            samples.push_back({t.keys[i], next - t.offsets[i]});
+            total += next - t.offsets[i];
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+    // cuts the key space whenever another 1/n of the bytes is passed
+    uint64_t bytes = 0;
+    for (auto &s : samples) {
+        if (bytes * n >= total * bounds.size() && s.first > bounds.back())
+            bounds.push_back(s.first);
+        bytes += s.second;
+    }
+    return bounds;
+}
+
+void KVStore::runSubcompaction(const std::vector<Location> &inputs,
+                               bool dropDeleted, Subcompaction &sub) const {
     // merge
+    std::vector<std::vector<Pair>> runs;
+    for (auto &l : inputs) {
+        // reads the range of the ssTable and build pair vector
+        const IndexTable &t = indexTableList[getIndex(l)];
+        std::vector<Pair> p = readSsTable(resolvePath(l), t, sub.min, sub.max);
+        for (auto &i : p) sub.bytesRead += DATA_CONST_SIZE + i.val.length();
+        // entries deleted by a range go at any level; the older entries of
+        // their keys are deleted by the same range, so each input is
+        // filtered by its own sequence before the merge
+        if (!rangeTombstones.empty())
+            p.erase(std::remove_if(p.begin(), p.end(),
+                                   [&](const Pair &e) {
+                                       return e.time <= deletedAt(t, e.key);
+                                   }),
+                    p.end());
+        runs.push_back(std::move(p));
+    }
+    // merges neighbouring runs pairwise, newer into older, so an entry is
+    // moved log(inputs) times rather than once per input after it
+    while (runs.size() > 1) {
+        std::vector<std::vector<Pair>> merged;
+        for (size_t i = 0; i + 1 < runs.size(); i += 2)
+            merged.push_back(merge(std::move(runs[i]), std::move(runs[i + 1])));
+        if (runs.size() % 2) merged.push_back(std::move(runs.back()));
+        runs.swap(merged);
+    }
     std::vector<Pair> all;
-    for (size_t i = 0; i < id.size(); i++) {
-        // reads ssTable and build pair vector
-        std::vector<Pair> t = readSsTable(id[i].level, id[i].id);
-        all = merge(all, t);
-    }
-    // std::clog << "Merged all data: " << std::endl;
-    // for (auto &i : all)
-    // std::clog << "\t" << i.key << ":\t" << std::string(i.val, 0, 50)
-    // << std::endl;
-    // update state: removes indexTable from memory, updates fileNum
-    for (int i = (int)id.size() - 1; i >= 0; i--) {
-        indexTableList.erase(indexTableList.begin() + getIndex(id[i]));
-        fileNum[id[i].level]--;
-        if (!std::filesystem::remove(resolvePath(id[i])))
-            std::clog << "error deleting " << resolvePath(id[i]) << std::endl;
-    }
-    // slice merged data and write to disk
-    // program state is updated in call to writeSsTable
+    if (!runs.empty()) all = std::move(runs[0]);
+    // expired entries become deletions, which go at the bottom like any
+    // other and hide the older entries of their keys until then
+    int64_t now = time(nullptr);
+    for (auto &p : all) {
+        if (!expired(p.expiresAt, now)) continue;
+        p.val.clear();
+        p.indirect = false;
+        p.expiresAt = 0;
+        sub.expired++;
+    }
+    if (dropDeleted) {
+        all.erase(std::remove_if(all.begin(), all.end(),
+                                 [](const Pair &p) { return p.val == ""; }),
+                  all.end());
+    }
+    // slice merged data and write to the temporary folder
     uint64_t size = 0;
     std::vector<Pair> tmp;
-    if (nextLvPos == -1) nextLvPos = 0;
-    // renames all file in nextLv to avoid rename hazard
-    renameLevel(nextLv, 0);
-    for (auto &i : all) {
-        size += i.val.length() + DATA_CONST_SIZE;
-        tmp.push_back(i);
-        if (size >= MEM_TABLE_SIZE_MAX || i.key == all.back().key) {
-            writeSsTable(tmp, Location(nextLv, nextLvPos++), true);
+    for (size_t i = 0; i < all.size(); i++) {
+        size += all[i].val.length() + DATA_CONST_SIZE;
+        tmp.push_back(all[i]);
+        if (size >= options.tableBytes || i + 1 == all.size()) {
+            std::string name = "output-" + std::to_string(sub.id) + "-" +
+                               std::to_string(sub.paths.size());
+            std::string path =
+                (std::filesystem::path(resolvePath(-1)) / name).string();
+            sub.tables.push_back(writeSsTable(tmp, sub.sequence, path));
+            sub.paths.push_back(path);
+            sub.bytesWritten += sub.tables.back().size;
             size = 0;
             tmp.clear();
         }
     }
-    renameLevel(nextLv, 1);
-    // call compaction on next level if necessary
-    if (fileNum[nextLv] > levelSizeLim(nextLv)) compaction(nextLv);
 }
 
-std::vector<Pair> KVStore::merge(std::vector<Pair> a, std::vector<Pair> b) {
+void KVStore::trivialMove(Location src, int level, int pos) {
+    if (verbose)
+        std::clog << "move " << resolvePath(src) << " to level " << level
+                  << std::endl;
+    std::string tmp = resolvePath(-1);
+    if (!std::filesystem::exists(tmp)) std::filesystem::create_directories(tmp);
+    std::string moving = (std::filesystem::path(tmp) / "moving").string();
+    std::filesystem::rename(resolvePath(src), moving);
+    IndexTable t = indexTableList[getIndex(src)];
+    indexTableList.erase(indexTableList.begin() + getIndex(src));
+    fileNum[src.level]--;
+    std::vector<int> from;
+    for (int i = 0; i <= fileNum[src.level]; i++)
+        if (i != src.id) from.push_back(i);
+    renameLevel(src.level, from);
+    from.clear();
+    for (int i = 0; i < fileNum[level]; i++) {
+        if (i == pos) from.push_back(-1);
+        from.push_back(i);
+    }
+    if (pos == fileNum[level]) from.push_back(-1);
+    renameLevel(level, from);
+    std::filesystem::rename(moving, resolvePath(level, pos));
+    if (options.syncTables) syncDir(resolvePath(level));
+    admitTable(t, level);
+    indexTableList.insert(indexTableList.begin() + getIndex(level, pos), t);
+    fileNum[level]++;
+    stats.trivialMoves++;
+}
+
+std::vector<Pair> KVStore::merge(std::vector<Pair> a,
+                                 std::vector<Pair> b) const {
     std::vector<Pair> tmp;
     size_t i = 0, j = 0;
+    tmp.reserve(a.size() + b.size());
+    // a and b are copies, their entries are moved
     while (i < a.size() && j < b.size()) {
         if (a[i].key < b[j].key)
-            tmp.push_back(a[i++]);
+            tmp.push_back(std::move(a[i++]));
         else if (a[i].key > b[j].key)
-            tmp.push_back(b[j++]);
+            tmp.push_back(std::move(b[j++]));
         else {
-            // two entries with the same key, keeps the one with newer timestamp
-            Pair p = a[i].time > b[j].time ? a[i] : b[j];
-            tmp.push_back(p);
+            // two entries with the same key, keeps the newer one from a
+            tmp.push_back(std::move(a[i]));
             i++;
             j++;
         }
     }
     while (i < a.size()) {
-        tmp.push_back(a[i++]);
+        tmp.push_back(std::move(a[i++]));
     }
     while (j < b.size()) {
-        tmp.push_back(b[j++]);
+        tmp.push_back(std::move(b[j++]));
     }
-    // std::clog << "tmp merged: " << std::endl;
-    // for (auto i : tmp) {
-    //     std::clog << i.key << " " << i.val << std::endl;
-    // }
     return tmp;
 }
 
-void KVStore::renameLevel(int level, int mode) {
-    if (mode == 0) {
-        int id = 0;
-        if (!std::filesystem::exists(resolvePath(-1)))
-            std::filesystem::create_directories(resolvePath(-1));
-        while (std::filesystem::exists(resolvePath(level, id))) {
-            std::filesystem::rename(resolvePath(level, id),
-                                    resolvePath(-1, id));
-            std::clog << "rename " << resolvePath(level, id) << "->"
-                      << resolvePath(-1, id) << std::endl;
-            id++;
-        }
-    } else if (mode == 1) {
-        int tmp = 0;
-        int id = 0;
-        while (std::filesystem::exists(resolvePath(-1, tmp))) {
-            while (std::filesystem::exists(resolvePath(level, id))) id++;
-            std::filesystem::rename(resolvePath(-1, tmp++),
-                                    resolvePath(level, id++));
-            std::clog << "rename " << resolvePath(-1, tmp - 1) << "->"
-                      << resolvePath(level, id - 1) << std::endl;
-        }
-    } else {
-        std::clog << "error no rename with mode " << mode << std::endl;
+void KVStore::renameLevel(int level, const std::vector<int> &from) {
+    if (!std::filesystem::exists(resolvePath(-1)))
+        std::filesystem::create_directories(resolvePath(-1));
+    // moves tables to the temporary folder first, so that a new name never
+    // collides with a table that hasn't been moved yet
+    for (size_t i = 0; i < from.size(); i++) {
+        if (from[i] == -1 || from[i] == (int)i) continue;
+        std::filesystem::rename(resolvePath(level, from[i]),
+                                resolvePath(-1, from[i]));
+    }
+    for (size_t i = 0; i < from.size(); i++) {
+        if (from[i] == -1 || from[i] == (int)i) continue;
+        std::filesystem::rename(resolvePath(-1, from[i]),
+                                resolvePath(level, i));
+        if (verbose)
+            std::clog << "rename " << resolvePath(level, from[i]) << "->"
+                      << resolvePath(level, i) << std::endl;
     }
 }
 
@@ -563,13 +2153,24 @@ int KVStore::getIndex(int level, int id) const {
     return index;
 }
 
-int KVStore::getIndex(Location &loc) const {
+Location KVStore::getLocation(int index) const {
+    int level = 0;
+    while (index - fileNum[level] >= 0) {
+        index -= fileNum[level];
+        level++;
+    }
+    return Location(level, index);
+}
+
+int KVStore::getIndex(const Location &loc) const {
     return getIndex(loc.level, loc.id);
 }
 
 std::tuple<uint64_t, uint64_t> KVStore::getKeyRange(int level, int id) {
-    // uint64_t min = indexTable
-    return {1, 2};
+    const IndexTable &t = indexTableList[getIndex(level, id)];
+    if (t.properties.present)
+        return {t.properties.minKey, t.properties.maxKey};
+    return {t.minKey(), t.maxKey()};
 }
 
 void KVStore::trigger() { convertMemTable(); }
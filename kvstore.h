@@ -1,35 +1,140 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include "common.h"
+#include "compaction.h"
+#include "index_cache.h"
 #include "kvstore_api.h"
+#include "mapped_file.h"
+#include "options.h"
+#include "row_cache.h"
 #include "skiplist.h"
-
+#include "table_builder.h"
+#include "thread_pool.h"
+#include "value_log.h"
+#include "write_ahead_log.h"
+#include "write_buffer_manager.h"
+
+// put and del may be called from several threads at once: they join a write
+// queue and the writer at its front applies the writes of all the others
+// queued behind it. The other operations must not run concurrently with any
+// operation.
 class KVStore : public KVStoreAPI {
    public:
-    KVStore(const std::string &dir);
+    KVStore(const std::string &dir, const Options &options = Options());
 
     ~KVStore();
 
     void put(uint64_t key, const std::string &s) override;
 
+    // Puts key like put with an entry that expires ttl seconds from now, or
+    // never if ttl is 0. Gets and scans treat an expired entry as deleted,
+    // it still hides the older entries of its key; compaction turns it into
+    // a tombstone and drops it at the last level, so expiry costs no writes
+    // of its own.
+    void put(uint64_t key, const std::string &s, uint64_t ttl);
+
     std::string get(uint64_t key) override;
 
     bool del(uint64_t key) override;
 
+    void scan(uint64_t key1, uint64_t key2,
+              std::list<std::pair<uint64_t, std::string>> &list) override;
+
+    // Returns the value of key like get, without copying values stored in
+    // tables: the handle points into the mapped table and keeps the mapping
+    // alive until it is released, even if compaction deletes the table.
+    PinnedValue getPinned(uint64_t key);
+
+    // Looks up key like get and passes the value to done. A memTable hit, or
+    // a key no table can hold, completes inline before getAsync returns;
+    // otherwise the entry is read from the mapped table on an io thread and
+    // done runs there, so it must not call back into the store. A get in
+    // flight may miss a value log file reclaimed by garbageCollectValueLog.
+    void getAsync(uint64_t key,
+                  std::function<void(const std::string &)> done);
+
+    // puts key like put and calls done, inline since a put only writes to
+    // the memTable unless it fills up
+    void putAsync(uint64_t key, const std::string &s,
+                  std::function<void()> done);
+
+    // the values of keys, empty for keys not found; range filters let each
+    // key skip the tables that can't hold it
+    std::vector<std::string> multiGet(const std::vector<uint64_t> &keys);
+
+    // Deletes the keys in [start, end]. The memTable drops its keys in the
+    // range and the tables get a range tombstone, which hides their entries
+    // in the range from gets and scans until compaction drops them, so the
+    // cost doesn't depend on the number of keys on disk. A tombstone goes
+    // once compaction has merged every table it could hide entries of.
+    void deleteRange(uint64_t start, uint64_t end);
+
+    // Moves ss-tables built by SstWriter into the store without rewriting
+    // them; their entries win over the entries already stored. Each table
+    // goes to the deepest level that neither it nor any level above
+    // overlaps, or to the top of level 0; a memTable overlapping it is
+    // flushed first. A table takes the next sequence number, so it is newer
+    // than every range deleted before. Returns false and stops at the first
+    // table that can't be read, that an overlapping memTable can't be
+    // flushed for, or one without a sequence field that a range tombstone
+    // written after it would hide.
+    bool ingestFiles(const std::vector<std::string> &paths);
+
+    // Creates a copy of the store in the empty or missing folder target
+    // that opens as a KVStore of its own. The memTable is written as the
+    // newest table of level 0 and the other tables, the value log and the
+    // range tombstones are hard-linked, copied only if target is on another
+    // file system. Writes wait while the checkpoint is taken, which costs a
+    // memTable flush and a link per file. Returns false if target isn't
+    // empty or a file can't be written.
+    bool createCheckpoint(const std::string &target);
+
     void reset() override;
 
+    // Resets the store like reset without waiting for the files to be
+    // deleted: the folders of the store are renamed into a trash folder,
+    // which a background thread deletes.
+    void resetAsync();
+
     void trigger();  // debug TODO: delete
 
+    const Stats &getStats() const { return stats; }
+
+    // the total size in bytes of all ss-tables and the value log
+    uint64_t sizeOnDisk() const;
+
+    // the memory pinned by the index tables, fences and models of all
+    // ss-tables
+    uint64_t indexMemoryBytes() const;
+
+    // the memory taken by index blocks in the index cache
+    uint64_t cachedIndexBytes() const;
+
+    // the memory taken by values in the row cache
+    uint64_t cachedRowBytes() const;
+
+    // Reclaims the oldest sealed file of the value log: values that tables
+    // still point to are put again and the file is deleted once they are
+    // flushed. Returns false if there is no sealed file or the memTable
+    // can't be flushed, which keeps the file.
+    bool garbageCollectValueLog();
+
    private:
     std::string dir;
+    Options options;
     bool verbose = true;
-
-    static const uint64_t MEM_TABLE_SIZE_MAX = 2 * 1024 * 1024;
-    // static const uint64_t MEM_TABLE_SIZE_MAX = 200;
+    Stats stats;
 
     // Maintains the size of the ss-table to generate, an data entry is composed
     // of key (8 bytes), length of string (8 bytes), a timestamp (8 bytes) and
@@ -42,36 +147,272 @@ class KVStore : public KVStoreAPI {
         return DATA_CONST_SIZE + strSize;
     };
 
-    int levelSizeLim(int level) const { return (1 << (level + 1)); }
-
     uint64_t memTableSize;
 
+    // A put or del waiting in the write queue, or a task that runs alone
+    // once the writes before it are applied
+    struct Writer {
+        WriteAheadLog::Op op;
+        uint64_t key;
+        const std::string *val;
+        std::function<void()> task;
+        bool done = false;
+        bool result = false;  // whether a deleted key existed
+        std::condition_variable cv;
+        Writer(WriteAheadLog::Op op, uint64_t key, const std::string *val)
+            : op(op), key(key), val(val) {}
+        explicit Writer(std::function<void()> task)
+            : op(WriteAheadLog::PUT), key(0), val(nullptr), task(task) {}
+    };
+
+    // the most bytes of values a leader takes into its write group
+    static const uint64_t MAX_WRITE_GROUP_BYTES = 1 << 20;
+
+    std::mutex writeMutex;
+    std::deque<Writer *> writers;  // the write queue, from its leader
+
+    // Queues w and waits until it is applied. The writer at the front
+    // becomes the leader: it takes the writers behind it into a group,
+    // appends their records to the log with one write and sync, applies
+    // them to the memTable and wakes them up.
+    void write(Writer &w);
+
+    // puts key with an entry that expires at expiresAt, 0 for never
+    void putUntil(uint64_t key, const std::string &s, int64_t expiresAt);
+
+    // applies a put or del to the memTable, returns whether a deleted key
+    // existed
+    bool apply(WriteAheadLog::Op op, uint64_t key, const std::string &s);
+
+    // the del of a key applied to the memTable
+    bool remove(uint64_t key);
+
+    // the deleteRange of [start, end] applied to the memTable and tables
+    void removeRange(uint64_t start, uint64_t end);
+
+    // Entries of keys in [start, end] in tables and sealed memTables of a
+    // sequence number up to sequence are deleted
+    struct RangeTombstone {
+        uint64_t start;
+        uint64_t end;
+        int64_t sequence;
+    };
+
+    // the deleted ranges cut into fragments that don't overlap, by start,
+    // each deleted up to the newest sequence of the ranges covering it
+    std::map<uint64_t, RangeTombstone> rangeTombstones;
+
+    // adds t to the fragments, cutting those it overlaps at its ends
+    void addRangeTombstone(const RangeTombstone &t);
+
+    // The last sequence number handed out. Sealed memTables, the tables they
+    // become and the outputs of a compaction take the next one, and so does
+    // a range tombstone, which orders them apart from the times entries are
+    // stamped with. It is recovered from the tables and tombstones on open.
+    int64_t sequence = 0;
+
+    // the sequence of the newest range tombstone covering key, -1 if none
+    // does
+    int64_t rangeDeletedAt(uint64_t key) const;
+
+    // the time the entries of key in table are deleted up to: every time if
+    // a tombstone covers the sequence of the table, the sequence of the
+    // tombstone for a table written before tables had one
+    int64_t deletedAt(const IndexTable &table, uint64_t key) const;
+
+    // the range tombstones are kept in a file of their own: a deleteRange
+    // appends its range, and the file is rewritten from the fragments when
+    // some are dropped
+    void loadRangeTombstones();
+    void appendRangeTombstone(const RangeTombstone &t) const;
+    void saveRangeTombstones() const;
+
+    // drops the fragments no table or sealed memTable can hold entries of
+    // anymore, which compaction leaves behind once it has merged all the
+    // tables older than a fragment in its range
+    void dropRangeTombstones();
+
+    // deletes the versions resetAsync moved away, nullptr until the first
+    std::unique_ptr<ThreadPool> reclaimer;
+
+    // the number of the last trash folder
+    uint64_t trashNumber = 0;
+
+    // moves the named files and folders of the store into a new trash
+    // folder, in order, and deletes it in the background
+    void moveToTrash(const std::vector<std::string> &names);
+
+    // deletes a trash folder in the background
+    void reclaim(const std::string &trash);
+
+    // flushes the memTable if it is full, or queues it for the flusher, and
+    // installs the tables the flusher has written
+    void maybeFlush();
+
+    // the time each key of a memTable put with a ttl expires at
+    typedef std::unordered_map<uint64_t, int64_t> Expiries;
+
+    // A full memTable sealed for a flush in the background. The flusher
+    // writes it to path while gets still find its entries here.
+    struct ImmutableMemTable {
+        std::unique_ptr<SkipList<uint64_t, std::string>> table;
+        Expiries expiries;
+        uint64_t size;      // memTableSize when it was sealed
+        int64_t writeTime;  // the time its entries are stamped with
+        int64_t sequence;   // the sequence of the table it becomes
+        std::string path;
+        std::string log;  // its sealed write-ahead log, empty without one
+        IndexTable result = IndexTable({}, {}, 0, 0);  // empty on failure
+        uint64_t micros = 0;  // the time the flush took
+        int failures = 0;     // the writes of its table that failed
+        std::future<void> flushed;
+    };
+
+    // the sealed memTables from the oldest, each newer than the tables
+    std::deque<std::shared_ptr<ImmutableMemTable>> immutables;
+
+    // writes the immutable memTables, nullptr until the first one
+    std::unique_ptr<ThreadPool> flusher;
+
+    // the number of the last memTable sealed
+    uint64_t sealNumber = 0;
+
+    // the bytes charged to Options::writeBufferManager
+    uint64_t chargedBytes = 0;
+
+    // seals the memTable with its log and queues it for the flusher
+    void switchMemTable();
+
+    // queues the write of the table of m for the flusher
+    void submitFlush(ImmutableMemTable *m);
+
+    // Moves the tables the flusher has written to level 0 in order, after
+    // waiting for the oldest one if wait is set. A table that failed is
+    // queued again and the ones after it wait, the memTable and its log
+    // are kept meanwhile. Returns whether it moved any; the caller runs
+    // the compaction they may need.
+    bool installFlushes(bool wait);
+
+    // Waits for and installs all immutable memTables. Returns false, with
+    // the rest left for a later retry, once the oldest has failed
+    // MAX_FLUSH_FAILURES times.
+    bool drainFlushes();
+
+    static constexpr int MAX_FLUSH_FAILURES = 3;
+
+    // waits for the flusher and drops the immutable memTables with their
+    // tables and logs
+    void discardFlushes();
+
+    // the value of key in the memTable or else in the newest immutable one
+    // holding it, nullptr if none does and empty if the entry has expired
+    const std::string *findInMemory(uint64_t key) const;
+
+    // charges the write buffer manager with the bytes of the memTables
+    void chargeWriteBuffer();
+
+    // nullptr unless Options::writeAheadLog is set
+    std::unique_ptr<WriteAheadLog> wal;
+
     std::unique_ptr<SkipList<uint64_t, std::string>> memTable;
 
+    Expiries memTableExpiries;
+
     // a vector holds all index tables
-    std::vector<std::vector<Index>> indexTableList;
+    std::vector<IndexTable> indexTableList;
 
     int level;                 // the number of current levels
     std::vector<int> fileNum;  // the number of ss-tables in each level
 
-    // turns memTable into ssTable and resets memTable
-    void convertMemTable();
+    // turns memTable into ssTable after the immutable ones, false if the
+    // table can't be written; the memTable is kept either way
+    bool convertMemTable();
+
+    // converts the memTable and, once its table is installed, resets it and
+    // drops the logs of its writes; false if they are kept for a retry
+    bool flushMemTable();
+
+    // the sealed logs replayed into the memTable on open, dropped with it
+    std::vector<std::string> replayedLogs;
+
+    // moves a flushed table from tmp to the top of level 0
+    void installTable(IndexTable &table, const std::string &tmp);
+
+    // writes a memTable to a table of the given sequence at path with its
+    // entries stamped with writeTime, moving large values to the value log
+    // if separate is set; entries already expired are written as deletions
+    IndexTable writeMemTable(SkipList<uint64_t, std::string> &table,
+                             const Expiries &expiries, int64_t writeTime,
+                             int64_t sequence, const std::string &path,
+                             bool separate);
+
+    // the task of createCheckpoint, run with no write in progress
+    bool writeCheckpoint(const std::string &target);
 
     // loads all available SS-Table on disk into memory
     void loadSsTable();
 
     // loads index tables into memory, the function should only be called on
     // startup in sequence
-    void readSsTable(std::string path);
+    void readSsTable(std::string path, int level);
+
+    // numbers a table entering level, and releases its index table unless
+    // the level is pinned and a model or the index cache can stand in
+    void admitTable(IndexTable &table, int level);
+
+    // the number of the last table admitted
+    uint64_t tableNumber = 0;
 
-    std::vector<Pair> readSsTable(int level, int id);
+    // tables mapped by getPinned, by their number
+    std::unordered_map<uint64_t, std::shared_ptr<MappedFile>> mappedTables;
 
-    void writeEntry(std::fstream &fs, Entry &e);
+    // the mapping of table index in indexTableList
+    std::shared_ptr<MappedFile> mapTable(int index);
+
+    // finds the value of the entry at offset in a mapped table, returns
+    // false if the entry passes the end of the file; the value of an
+    // expired entry is empty
+    static bool parseEntry(const MappedFile &file, uint64_t offset,
+                           bool compact, const char *&val, uint64_t &len,
+                           bool &indirect, int64_t *time = nullptr,
+                           int64_t *expiresAt = nullptr);
+
+    // reads the entries of getAsync, nullptr until the first one
+    std::unique_ptr<ThreadPool> ioPool;
+
+    // index blocks of released tables without a model, nullptr if index
+    // tables are kept in memory
+    std::unique_ptr<IndexCache> indexCache;
+
+    // values of hot keys read from the ss-tables, nullptr if disabled
+    std::unique_ptr<RowCache> rowCache;
+
+    // reads the index table and model of an ss-table
+    IndexTable loadIndex(const std::string &path) const;
+
+    // reads the entries with keys in [min, max] of a table
+    std::vector<Pair> readSsTable(const std::string &path,
+                                  const IndexTable &table, uint64_t min,
+                                  uint64_t max) const;
 
     // Finds the given key in index tables and return the index of the table in
     // index table list. Return value -1 indicates the key doesn't exist.
     // Saves the offset of the entry in optional parameter offsetDst.
-    int findIndexedKey(uint64_t key, uint64_t *offsetDst = nullptr) const;
+    int findIndexedKey(uint64_t key, uint64_t *offsetDst = nullptr);
+
+    // looks for key in the index block of table index in indexTableList
+    // that its fences point at, through the index cache
+    bool searchBlock(int index, uint64_t key, uint64_t *offset);
+
+    // reads an index block of a table
+    std::shared_ptr<const IndexBlock> readIndexBlock(
+        const std::string &path, const IndexTable &table,
+        uint64_t block) const;
+
+    // looks for key in the index entries of a released table that its model
+    // predicts, saves the offset of the entry if it is found
+    bool searchModel(const std::string &path, const IndexTable &table,
+                     uint64_t key, uint64_t *offset) const;
 
     // resolves the path of sstable x in level y
     std::string resolvePath(int level, int id) const;
@@ -79,33 +420,140 @@ class KVStore : public KVStoreAPI {
     // resolves the path of level, if -1 is passed, returns temporary folder
     std::string resolvePath(int level) const;
 
-    std::string resolvePath(Location &l) const;
+    std::string resolvePath(const Location &l) const;
 
-    // reads string in ss-table by offset, caller should ensure the key exists
-    std::string readPair(std::string path, uint64_t offset);
+    // reads string in ss-table by offset, caller should ensure the key exists;
+    // the value is empty if the entry is stamped no later than deletedAt or
+    // has expired
+    std::string readPair(std::string path, uint64_t offset, bool compact,
+                         int64_t deletedAt = -1, int64_t *expiresAt = nullptr);
+
+    // reads the value field of an entry as stored, which is an encoded
+    // ValuePointer if indirect is set, and the time and expiry of the entry;
+    // the value of an expired entry is empty
+    std::string readEntry(const std::string &path, uint64_t offset,
+                          bool compact, bool *indirect,
+                          int64_t *time = nullptr,
+                          int64_t *expiresAt = nullptr) const;
+
+    // large values separated from the tables, nullptr if disabled
+    std::unique_ptr<ValueLog> valueLog;
 
     // resets memTable and related data
     void resetMemTable();
 
-    // Writes ssTable to specified location.
-    // If tmp is set to true, then the function would writes to a temporary
-    // folder, with file named with l.id
-    // -> write to tmp and mv them later
-    void writeSsTable(std::vector<Pair> table, Location l, bool tmp = false);
+    // Writes ssTable to path and returns its index table. The function
+    // doesn't touch the state of the store, compaction calls it from several
+    // threads at once.
+    IndexTable writeSsTable(const std::vector<Pair> &table, int64_t sequence,
+                            const std::string &path) const;
+
+    std::unique_ptr<CompactionPolicy> policy;
+
+    // the tables of each level, as seen by the compaction policy
+    LevelView levelView() const;
+
+    // runs compaction until the policy picks no more
+    void maybeCompaction();
+
+    // merges the input tables of task and writes them to its output level
+    void compaction(const CompactionTask &task);
+
+    // A key range [min, max] of a compaction, merged on its own and written
+    // to temporary tables named after id
+    struct Subcompaction {
+        int id;
+        uint64_t min;
+        uint64_t max;
+        int64_t sequence;                // of the output tables
+        std::vector<std::string> paths;  // output tables in key order
+        std::vector<IndexTable> tables;
+        uint64_t bytesRead = 0;
+        uint64_t bytesWritten = 0;
+        uint64_t expired = 0;  // expired entries turned into deletions
+    };
+
+    // A compaction carried out a subcompaction at a time between writes.
+    // Flushes shift the ids of level 0 meanwhile, so its inputs are kept by
+    // table number and located again at every step.
+    struct CompactionJob {
+        CompactionTask task;
+        std::vector<uint64_t> inputs;  // the numbers of task.inputs
+        bool bottom;
+        std::vector<Subcompaction> subs;
+        size_t next = 0;         // the first subcompaction not yet run
+        uint64_t sliceBytes = 0;  // the input bytes of a subcompaction
+    };
+
+    // the incremental compaction in progress, nullptr if none
+    std::unique_ptr<CompactionJob> pendingCompaction;
+
+    // the input bytes the writes so far have paid for, at most one slice or
+    // two tables
+    uint64_t compactionCredit = 0;
+
+    // Prepares task and splits it into subcompactions, one per thread or,
+    // if sliced is set, one per slice of input. A single table is moved
+    // right away and nullptr returned.
+    std::unique_ptr<CompactionJob> startCompaction(const CompactionTask &task,
+                                                   bool sliced);
+
+    // the current locations of the inputs of job
+    std::vector<Location> locateInputs(const CompactionJob &job) const;
 
-    // void compaction();
+    // replaces the inputs of job with the outputs of its subcompactions
+    void installCompaction(CompactionJob &job);
 
-    // performs compaction on specified level other than level 0
-    void compaction(int level = 0);
+    // With incremental compaction, pays for the compaction of the input
+    // bytes written times the ratio and runs at most one subcompaction with
+    // the credit. Starts the next compaction once one is installed.
+    void advanceCompaction(uint64_t bytes);
 
-    // merges a and b
-    std::vector<Pair> merge(std::vector<Pair> a, std::vector<Pair> b);
+    // picks the next incremental compaction unless one is in progress
+    void pickCompaction();
 
-    void renameLevel(int level, int mode);
+    // runs the rest of the compaction in progress at once
+    void finishCompaction();
+
+    // drops the compaction in progress and its outputs, the inputs stay
+    void cancelCompaction();
+
+    // runs the subcompactions of large compactions in parallel, nullptr if
+    // only a single thread is used; Options::compactionPool if it is set
+    std::shared_ptr<ThreadPool> pool;
+
+    // throttles the writes of compaction, nullptr if they are not limited
+    std::unique_ptr<RateLimiter> limiter;
+
+    // Splits the key range of inputs into at most n ranges of about the same
+    // number of bytes, using the index tables of inputs as fences. Returns the
+    // smallest key of each range.
+    std::vector<uint64_t> subcompactionBounds(
+        const std::vector<Location> &inputs, int n) const;
+
+    // merges the entries of inputs within the range of sub, the function is
+    // run from the thread pool and must not change the state of the store;
+    // expired entries become deletions
+    void runSubcompaction(const std::vector<Location> &inputs,
+                          bool dropDeleted, Subcompaction &sub) const;
+
+    // moves a table to position pos of level without rewriting it
+    void trivialMove(Location src, int level, int pos);
+
+    // merges a and b, a is newer than b so its entry wins on the same key
+    std::vector<Pair> merge(std::vector<Pair> a, std::vector<Pair> b) const;
+
+    // Renames the tables in level so that table from[i] gets id i, an entry
+    // of -1 leaves id i free for a table written later. Tables not listed are
+    // expected to have been removed already.
+    void renameLevel(int level, const std::vector<int> &from);
 
     // returns the index of target cached indexTable in indexTableList
     int getIndex(int level, int id) const;
-    int getIndex(Location &loc) const;
+    int getIndex(const Location &loc) const;
+
+    // the inverse of getIndex
+    Location getLocation(int index) const;
 
     // returns the range of keys in file with id in level
     std::tuple<uint64_t, uint64_t> getKeyRange(int level, int id);
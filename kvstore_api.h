@@ -1,7 +1,9 @@
 #pragma once
 
 #include <cstdint>
+#include <list>
 #include <string>
+#include <utility>
 
 class KVStoreAPI {
 public:
@@ -32,6 +34,13 @@ public:
 	 */
 	virtual bool del(uint64_t key) = 0;
 
+	/**
+	 * Appends the key-value pairs with keys in [key1, key2] to list, in
+	 * ascending order of keys.
+	 */
+	virtual void scan(uint64_t key1, uint64_t key2,
+	                  std::list<std::pair<uint64_t, std::string>> &list) = 0;
+
 	/**
 	 * This resets the kvstore. All key-value pairs should be removed,
 	 * including memtable and all sstables files.
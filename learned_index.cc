@@ -0,0 +1,92 @@
+#include "learned_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+LinearModel LinearModel::build(const std::vector<uint64_t> &keys,
+                               uint64_t error) {
+    LinearModel model;
+    model.error = error;
+    if (keys.empty()) return model;
+    // the range of slopes from the start of the segment that keeps all keys
+    // of the segment within error
+    double lo = 0;
+    double hi = INFINITY;
+    Segment seg{keys[0], 0, 0};
+    for (uint64_t i = 1; i < keys.size(); i++) {
+        double dx = keys[i] - seg.key;
+        double dy = i - seg.pos;
+        double slope = dy / dx;
+        if (slope < lo || slope > hi) {
+            // the key is out of reach, it starts the next segment
+            seg.slope = std::isinf(hi) ? 0 : (lo + hi) / 2;
+            model.segments.push_back(seg);
+            seg = Segment{keys[i], i, 0};
+            lo = 0;
+            hi = INFINITY;
+            continue;
+        }
+        lo = std::max(lo, (dy - error) / dx);
+        hi = std::min(hi, (dy + error) / dx);
+    }
+    seg.slope = std::isinf(hi) ? 0 : (lo + hi) / 2;
+    model.segments.push_back(seg);
+    return model;
+}
+
+void LinearModel::predict(uint64_t key, uint64_t n, uint64_t &first,
+                          uint64_t &last) const {
+    auto it = std::upper_bound(
+        segments.begin(), segments.end(), key,
+        [](uint64_t key, const Segment &s) { return key < s.key; });
+    if (it == segments.begin()) {
+        first = last = 0;
+        return;
+    }
+    const Segment &s = *(it - 1);
+    double pos = s.pos + s.slope * (double)(key - s.key);
+    // one more position on each side absorbs the rounding of doubles
+    double lo = std::floor(pos) - error - 1;
+    double hi = std::ceil(pos) + error + 2;
+    first = lo < 0 ? 0 : std::min((uint64_t)lo, n);
+    last = hi < 0 ? 0 : std::min((uint64_t)hi, n);
+    // a segment never predicts past the next one
+    if (it != segments.end()) last = std::min(last, it->pos);
+    first = std::max(first, s.pos);
+}
+
+std::string LinearModel::encode() const {
+    std::string s(segments.size() * sizeof(Segment) + 16, '\0');
+    char *p = &s[0];
+    for (auto &seg : segments) {
+        memcpy(p, &seg.key, 8);
+        memcpy(p + 8, &seg.pos, 8);
+        memcpy(p + 16, &seg.slope, 8);
+        p += 24;
+    }
+    uint64_t count = segments.size();
+    memcpy(p, &count, 8);
+    memcpy(p + 8, &error, 8);
+    return s;
+}
+
+LinearModel LinearModel::decode(const std::string &s) {
+    LinearModel model;
+    if (s.length() < 16) return model;
+    const char *p = s.data() + s.length() - 16;
+    uint64_t count = 0;
+    memcpy(&count, p, 8);
+    memcpy(&model.error, p + 8, 8);
+    if (count * 24 + 16 != s.length()) return LinearModel();
+    p = s.data();
+    for (uint64_t i = 0; i < count; i++) {
+        Segment seg;
+        memcpy(&seg.key, p, 8);
+        memcpy(&seg.pos, p + 8, 8);
+        memcpy(&seg.slope, p + 16, 8);
+        model.segments.push_back(seg);
+        p += 24;
+    }
+    return model;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A piecewise linear model of the positions of the sorted keys of a table.
+// Each segment covers the keys from its own key up to the next segment's, and
+// predicts the position of any of them at most error positions off. Uniformly
+// distributed keys need only a few segments however many keys there are.
+class LinearModel {
+   public:
+    struct Segment {
+        uint64_t key;  // the first key the segment covers
+        uint64_t pos;  // the position of key
+        double slope;
+    };
+
+    LinearModel() : error(0) {}
+
+    // fits keys, which must be sorted and distinct, greedily with the fewest
+    // segments whose cone of slopes still holds every key
+    static LinearModel build(const std::vector<uint64_t> &keys,
+                             uint64_t error);
+
+    bool empty() const { return segments.empty(); }
+
+    // the range [first, last) of the positions, out of n, that may hold key
+    void predict(uint64_t key, uint64_t n, uint64_t &first,
+                 uint64_t &last) const;
+
+    // the size of the model in memory and on disk
+    uint64_t bytes() const { return segments.size() * sizeof(Segment); }
+
+    // the segments followed by their number and the error
+    std::string encode() const;
+
+    // decodes what encode returned, the model is empty on malformed data
+    static LinearModel decode(const std::string &s);
+
+    std::vector<Segment> segments;
+    uint64_t error;
+};
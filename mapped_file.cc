@@ -0,0 +1,34 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    off_t length = lseek(fd, 0, SEEK_END);
+    void *addr = MAP_FAILED;
+    if (length > 0) addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping stays valid without the descriptor
+    close(fd);
+    if (addr == MAP_FAILED) return nullptr;
+    return std::shared_ptr<MappedFile>(
+        new MappedFile(static_cast<const char *>(addr), length));
+}
+
+MappedFile::~MappedFile() { munmap(const_cast<char *>(addr), length); }
+
+PinnedValue::PinnedValue(std::string value) : ptr(nullptr), len(0) {
+    if (value.empty()) return;
+    auto copy = std::make_shared<const std::string>(std::move(value));
+    ptr = copy->data();
+    len = copy->size();
+    owner = copy;
+}
+
+void PinnedValue::reset() {
+    ptr = nullptr;
+    len = 0;
+    owner.reset();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// A read-only memory mapping of a whole file. It is unmapped when the last
+// reference goes, which may be long after the file was renamed or deleted.
+class MappedFile {
+   public:
+    // maps path, nullptr if it can't be opened or is empty
+    static std::shared_ptr<MappedFile> open(const std::string &path);
+
+    ~MappedFile();
+
+    const char *data() const { return addr; }
+    uint64_t size() const { return length; }
+
+   private:
+    MappedFile(const char *addr, uint64_t length)
+        : addr(addr), length(length) {}
+
+    const char *addr;
+    uint64_t length;
+};
+
+// A value returned without copying: data points into a mapped table and the
+// handle holds a reference to the mapping until it is released. Values that
+// don't live in a table, from the memTable or the value log, are copied once
+// into memory owned by the handle.
+class PinnedValue {
+   public:
+    PinnedValue() : ptr(nullptr), len(0) {}
+
+    PinnedValue(const char *data, size_t size,
+                std::shared_ptr<const void> owner)
+        : ptr(data), len(size), owner(std::move(owner)) {}
+
+    explicit PinnedValue(std::string value);
+
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+
+    // an empty value, the key was not found
+    bool empty() const { return len == 0; }
+
+    std::string toString() const { return std::string(ptr, len); }
+
+    // drops the reference to the backing memory
+    void reset();
+
+   private:
+    const char *ptr;
+    size_t len;
+    std::shared_ptr<const void> owner;
+};
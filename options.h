@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+enum class CompactionStyle { Leveled, Tiered };
+
+class ThreadPool;
+class WriteBufferManager;
+
+// Tunables of a KVStore. The defaults reproduce the behaviour of a store
+// constructed with a directory only.
+struct Options {
+    // the memTable is flushed once its entries take this many bytes, as
+    // counted by the 40 bytes of table space per entry plus the value
+    uint64_t memTableBytes = 2 * 1024 * 1024;
+
+    // Flushes in the background: a full memTable is sealed and queued for a
+    // flush thread, and gets still find its entries, while writes go on in
+    // a new one. Writes stall once more than this many memTables wait. 0
+    // flushes in the foreground. A store with a value log always flushes in
+    // the foreground, the log is not shared between threads.
+    int maxImmutableMemTables = 0;
+
+    // a budget for the memTables of all stores sharing it, nullptr for none
+    // (see write_buffer_manager.h)
+    std::shared_ptr<WriteBufferManager> writeBufferManager;
+
+    // compaction cuts its output into tables of about this many bytes
+    uint64_t tableBytes = 2 * 1024 * 1024;
+
+    // see compaction.h
+    CompactionStyle compactionStyle = CompactionStyle::Leveled;
+
+    // the number of ss-tables in level 0 that triggers a level 0 compaction
+    int l0CompactionTrigger = 3;
+
+    // target size in bytes of level 1, level n (n > 1) is targeted at
+    // levelBaseBytes * levelMultiplier ^ (n - 1)
+    uint64_t levelBaseBytes = 8 * 1024 * 1024;
+    int levelMultiplier = 10;
+
+    // tiered compaction: the number of sorted runs that triggers a compaction
+    int tieredRunTrigger = 8;
+    // tiered compaction: runs are of similar size if the next run is at most
+    // tieredSizeRatio percent larger than the runs picked before it
+    int tieredSizeRatio = 1;
+    // tiered compaction: merges all runs once the runs other than the oldest
+    // one take more than this percentage of its size
+    int tieredMaxSpaceAmplification = 200;
+    // tiered compaction: the number of levels the runs are spread over
+    int tieredNumLevels = 7;
+
+    // the number of threads a large compaction is split over by key range,
+    // 0 uses one per hardware thread
+    int maxSubcompactions = 0;
+
+    // the threads subcompactions run on, shared by the stores given the
+    // same pool; nullptr gives each store a pool of its own of
+    // maxSubcompactions threads
+    std::shared_ptr<ThreadPool> compactionPool;
+
+    // Compacts incrementally: every write pays for this many bytes of
+    // compaction input per byte and runs a slice of the compaction in
+    // progress once it has paid for one, instead of compacting all levels
+    // at once after a flush. 0 compacts at once.
+    uint64_t incrementalCompactionRatio = 0;
+
+    // tables are written through a buffer of this many bytes
+    uint64_t tableWriteBuffer = 1 << 20;
+
+    // a flush encodes the memTable into one buffer while a thread writes
+    // the other one out (see TableBuilder)
+    bool pipelinedFlush = false;
+
+    // writes tables with delta keys and varint headers and index entries
+    // (see TableBuilder), which saves most of the 40 bytes per entry of
+    // small values; tables of either format are read. Compact tables get no
+    // learned index.
+    bool compactTables = false;
+
+    // writes compaction output with O_DIRECT, which keeps the page cache for
+    // the tables gets read from
+    bool directIOForCompaction = false;
+
+    // fdatasyncs every table, and its folder once it is moved there, before
+    // the table is used
+    bool syncTables = true;
+
+    // the most bytes per second compaction writes, 0 for no limit
+    uint64_t compactionRateLimit = 0;
+
+    // values of at least this many bytes are moved to the value log when the
+    // memTable is flushed, 0 keeps all values in the ss-tables
+    uint64_t valueLogThreshold = 0;
+    // the size at which a value log file is sealed
+    uint64_t valueLogFileSize = 64 * 1024 * 1024;
+
+    // tables get a LinearModel of their keys with this error, in positions,
+    // which stands in for the index table in memory; 0 keeps whole index
+    // tables in memory
+    uint64_t learnedIndexError = 0;
+
+    // With a budget set, only the fences of index tables stay in memory and
+    // their blocks are read on demand into a cache of this many bytes shared
+    // by all tables; 0 keeps whole index tables in memory
+    uint64_t indexCacheBytes = 0;
+    // index tables of levels below this one stay in memory whole even with a
+    // budget or a model, 0 pins none
+    int pinnedIndexLevels = 1;
+
+    // values read from the ss-tables are cached in this many bytes, keys
+    // that are looked up often are kept; 0 caches none
+    uint64_t rowCacheBytes = 0;
+
+    // the memTable keeps a hash index of its keys for O(1) gets and updates
+    bool memTableHashIndex = false;
+
+    // tables get a RangeFilter with this many bits per key prefix, which
+    // lets gets and narrow scans skip them; 0 builds no filters
+    uint64_t rangeFilterBitsPerKey = 0;
+
+    // logs every put and del in the write-ahead log before it reaches the
+    // memTable, which is rebuilt from the log when the store is opened
+    bool writeAheadLog = false;
+    // fdatasyncs the log once for each write group before its writers
+    // return
+    bool syncWrites = false;
+
+    // the threads reading the entries of getAsync
+    int ioThreads = 16;
+
+    // prints every operation and file movement to std::clog
+    bool verbose = false;
+};
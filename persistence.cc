@@ -2,7 +2,14 @@
 #include <cstdint>
 #include <string>
 #include <cassert>
+#include <filesystem>
+#include <list>
+#include <map>
 
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sharded_kvstore.h"
 #include "test.h"
 
 class PersistenceTest : public Test {
@@ -117,6 +124,271 @@ private:
 		report();
 	}
 
+	const std::string CRASH_DIR = "./data-crash";
+
+	// runs body in a child process, which exits without closing the
+	// stores it opened like a crash would
+	template<typename F>
+	void crash(F body)
+	{
+		std::cout.flush();
+		pid_t pid = fork();
+		if (pid == 0) {
+			body();
+			_exit(0);
+		}
+		int status = 0;
+		waitpid(pid, &status, 0);
+	}
+
+	// runs writes on a store with a write-ahead log at dir in a child
+	// process
+	template<typename F>
+	void crash(const std::string &dir, const Options &options, F writes)
+	{
+		crash([&] {
+			KVStore s(dir, options);
+			writes(s);
+		});
+	}
+
+	void crash_test(void)
+	{
+		Options options;
+		options.writeAheadLog = true;
+		uint64_t i;
+
+		// Test replay of every kind of record
+		std::filesystem::remove_all(CRASH_DIR);
+		crash(CRASH_DIR, options, [](KVStore &s) {
+			for (uint64_t i = 0; i < 1024; ++i)
+				s.put(i, std::string(i % 64 + 1, 'a' + i % 26));
+			for (uint64_t i = 1; i < 1024; i += 8)
+				s.del(i);
+			s.deleteRange(512, 767);
+			s.put(600, "after");
+			for (uint64_t i = 800; i < 810; ++i)
+				s.put(i, "short", 1);
+			for (uint64_t i = 810; i < 820; ++i)
+				s.put(i, "long", 3600);
+		});
+		// the short ttl has passed
+		sleep(2);
+		{
+			KVStore s(CRASH_DIR, options);
+			uint64_t live = 0;
+			for (i = 0; i < 1024; ++i) {
+				std::string exp(i % 64 + 1, 'a' + i % 26);
+				if (i % 8 == 1 || (i >= 512 && i <= 767) ||
+				    (i >= 800 && i < 810))
+					exp = not_found;
+				if (i == 600)
+					exp = "after";
+				if (i >= 810 && i < 820)
+					exp = "long";
+				EXPECT(exp, s.get(i));
+				live += exp != not_found;
+			}
+			std::list<std::pair<uint64_t, std::string>> list;
+			s.scan(0, 1023, list);
+			EXPECT(live, (uint64_t)list.size());
+		}
+		phase();
+
+		// Test a log torn in its last record
+		std::filesystem::remove_all(CRASH_DIR);
+		crash(CRASH_DIR, options, [](KVStore &s) {
+			for (uint64_t i = 0; i < 100; ++i)
+				s.put(i, std::string(i + 1, 'v'));
+			s.put(100, std::string(4096, 'z'));
+		});
+		std::filesystem::path log = std::filesystem::path(CRASH_DIR) / "wal";
+		std::filesystem::resize_file(log, std::filesystem::file_size(log) - 100);
+		{
+			KVStore s(CRASH_DIR, options);
+			for (i = 0; i < 100; ++i)
+				EXPECT(std::string(i + 1, 'v'), s.get(i));
+			EXPECT(not_found, s.get(100));
+		}
+		// later records follow the last complete one
+		crash(CRASH_DIR, options, [](KVStore &s) {
+			s.put(101, "next");
+		});
+		{
+			KVStore s(CRASH_DIR, options);
+			for (i = 0; i < 100; ++i)
+				EXPECT(std::string(i + 1, 'v'), s.get(i));
+			EXPECT(not_found, s.get(100));
+			EXPECT(std::string("next"), s.get(101));
+		}
+		phase();
+
+		// Test that sealed logs are replayed before the active one: the
+		// log of a sealed memTable is made from one store, the active log
+		// from another
+		std::string other = CRASH_DIR + "-other";
+		std::filesystem::remove_all(CRASH_DIR);
+		std::filesystem::remove_all(other);
+		crash(CRASH_DIR, options, [](KVStore &s) {
+			for (uint64_t i = 0; i < 100; ++i)
+				s.put(i, "old");
+		});
+		crash(other, options, [](KVStore &s) {
+			for (uint64_t i = 0; i < 50; ++i)
+				s.put(i, "new");
+			s.deleteRange(90, 99);
+		});
+		std::filesystem::rename(std::filesystem::path(CRASH_DIR) / "wal",
+					std::filesystem::path(CRASH_DIR) / "wal-1");
+		std::filesystem::rename(std::filesystem::path(other) / "wal",
+					std::filesystem::path(CRASH_DIR) / "wal");
+		std::filesystem::remove_all(other);
+		for (int round = 0; round < 2; ++round) {
+			// the logs are in a table after the first open
+			KVStore s(CRASH_DIR, options);
+			for (i = 0; i < 100; ++i)
+				EXPECT(std::string(i < 50 ? "new" : i < 90 ? "old" : ""),
+				       s.get(i));
+		}
+		EXPECT(false, std::filesystem::exists(
+				      std::filesystem::path(CRASH_DIR) / "wal-1"));
+		phase();
+
+		// Test a crash while memTables wait for the flusher
+		std::filesystem::remove_all(CRASH_DIR);
+		options.memTableBytes = 64 * 1024;
+		options.maxImmutableMemTables = 2;
+		crash(CRASH_DIR, options, [](KVStore &s) {
+			for (uint64_t i = 0; i < 4096; ++i)
+				s.put(i, std::string(256, 'a' + i % 26));
+		});
+		{
+			KVStore s(CRASH_DIR, options);
+			for (i = 0; i < 4096; ++i)
+				EXPECT(std::string(256, 'a' + i % 26), s.get(i));
+		}
+		phase();
+
+		std::filesystem::remove_all(CRASH_DIR);
+		report();
+	}
+
+	const std::string SHARDED_DIR = "./data-sharded";
+
+	void sharded_check(ShardedKVStore &s,
+			   const std::map<uint64_t, std::string> &model,
+			   uint64_t max)
+	{
+		uint64_t i;
+		for (i = 0; i < max; ++i) {
+			auto it = model.find(i);
+			EXPECT(it != model.end() ? it->second : not_found, s.get(i));
+		}
+		std::list<std::pair<uint64_t, std::string>> list;
+		s.scan(0, max - 1, list);
+		EXPECT(model.size(), list.size());
+		auto it = model.begin();
+		for (auto &p : list) {
+			EXPECT(it->first, p.first);
+			EXPECT(it->second, p.second);
+			if (++it == model.end())
+				break;
+		}
+	}
+
+	// a sharded store crashed with writes in the logs of its shards
+	void sharded_test(uint64_t max)
+	{
+		Options options;
+		options.writeAheadLog = true;
+		options.memTableBytes = 64 * 1024;
+		std::map<uint64_t, std::string> model;
+		uint64_t i;
+		for (i = 0; i < max; ++i)
+			if (i % 5 != 0)
+				model[i] = std::string(i % 64 + 1, 'a' + i % 26);
+
+		// Test the writes after the crash
+		std::filesystem::remove_all(SHARDED_DIR);
+		crash([&] {
+			ShardedKVStore s(SHARDED_DIR, 4, options);
+			for (uint64_t i = 0; i < max; ++i)
+				s.put(i, std::string(i % 64 + 1, 'a' + i % 26));
+			for (uint64_t i = 0; i < max; i += 5)
+				s.del(i);
+		});
+		{
+			ShardedKVStore s(SHARDED_DIR, 4, options);
+			EXPECT(4, s.size());
+			sharded_check(s, model, max);
+		}
+		phase();
+
+		// Test after closing the store, reopened with another count
+		{
+			ShardedKVStore s(SHARDED_DIR, 2, options);
+			EXPECT(4, s.size());
+			sharded_check(s, model, max);
+		}
+		phase();
+
+		std::filesystem::remove_all(SHARDED_DIR);
+		report();
+	}
+
+	const std::string VLOG_DIR = "./data-vlog";
+
+	// values in the value log, reclaimed by garbage collection and
+	// crashed with the writes after it in the write-ahead log
+	void vlog_test(uint64_t max)
+	{
+		Options options;
+		options.writeAheadLog = true;
+		options.valueLogThreshold = 256;
+		options.valueLogFileSize = 256 * 1024;
+		uint64_t i;
+		auto value = [](uint64_t key, int round) {
+			return std::string(300 + key % 700, 'a' + (key + round) % 26);
+		};
+
+		std::filesystem::remove_all(VLOG_DIR);
+		crash([&] {
+			KVStore s(VLOG_DIR, options);
+			for (uint64_t i = 0; i < max; ++i)
+				s.put(i, value(i, 0));
+			for (uint64_t i = 0; i < max; i += 2)
+				s.put(i, value(i, 1));
+			for (uint64_t i = 1; i < max; i += 4)
+				s.del(i);
+			for (int n = 0; n < 4; ++n)
+				s.garbageCollectValueLog();
+			for (uint64_t i = 0; i < max; i += 3)
+				s.put(i, value(i, 2));
+		});
+		auto expected = [&](uint64_t i) {
+			if (i % 3 == 0)
+				return value(i, 2);
+			if (i % 4 == 1)
+				return not_found;
+			return value(i, i % 2 ? 0 : 1);
+		};
+
+		// Test the values after the crash
+		for (int round = 0; round < 2; ++round) {
+			KVStore s(VLOG_DIR, options);
+			for (i = 0; i < max; ++i)
+				EXPECT(expected(i), s.get(i));
+			// Test after collecting more of the log
+			EXPECT(true, s.garbageCollectValueLog());
+			for (i = 0; i < max; ++i)
+				EXPECT(expected(i), s.get(i));
+		}
+		phase();
+
+		std::filesystem::remove_all(VLOG_DIR);
+		report();
+	}
+
 public:
 	PersistenceTest(const std::string &dir, bool v=true) : Test(dir, v)
 	{
@@ -131,6 +403,12 @@ public:
 		if (testmode) {
 			std::cout << "<<Test Mode>>" << std::endl;
 			test(TEST_MAX);
+			std::cout << "<<Crash Test>>" << std::endl;
+			crash_test();
+			std::cout << "<<Sharded Test>>" << std::endl;
+			sharded_test(TEST_MAX / 4);
+			std::cout << "<<Value Log Test>>" << std::endl;
+			vlog_test(TEST_MAX / 4);
 		} else {
 			std::cout << "<<Preparation Mode>>" << std::endl;
 			prepare(TEST_MAX);
@@ -0,0 +1,76 @@
+#include "range_filter.h"
+
+#include <algorithm>
+
+constexpr int RangeFilter::SHIFTS[];
+
+namespace {
+
+// splitmix64, spreads prefixes that differ in a few low bits over the filter
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+}  // namespace
+
+RangeFilter RangeFilter::build(const std::vector<uint64_t> &keys,
+                               uint64_t bitsPerKey) {
+    RangeFilter filter;
+    if (keys.empty() || bitsPerKey == 0) return filter;
+    // sorted keys share prefixes, each distinct prefix is an item
+    uint64_t items = 0;
+    for (int shift : SHIFTS) {
+        items++;
+        for (size_t i = 1; i < keys.size(); i++)
+            if (keys[i] >> shift != keys[i - 1] >> shift) items++;
+    }
+    filter.bits.resize((items * bitsPerKey + 63) / 64);
+    // ln 2 * bits per item minimizes false positives
+    filter.probes = std::max(1, std::min(30, (int)(bitsPerKey * 69 / 100)));
+    for (int shift : SHIFTS) {
+        filter.add(shift, keys[0] >> shift);
+        for (size_t i = 1; i < keys.size(); i++)
+            if (keys[i] >> shift != keys[i - 1] >> shift)
+                filter.add(shift, keys[i] >> shift);
+    }
+    return filter;
+}
+
+bool RangeFilter::mayContain(uint64_t min, uint64_t max) const {
+    if (empty() || min > max) return true;
+    for (int shift : SHIFTS) {
+        uint64_t lo = min >> shift;
+        uint64_t hi = max >> shift;
+        if (hi - lo >= MAX_PREFIXES) continue;
+        for (uint64_t i = 0; i <= hi - lo; i++)
+            if (test(shift, lo + i)) return true;
+        return false;
+    }
+    return true;
+}
+
+void RangeFilter::add(int shift, uint64_t prefix) {
+    uint64_t h = mix(prefix ^ mix(shift));
+    uint64_t delta = (h >> 32) | 1;
+    uint64_t n = bits.size() * 64;
+    for (int i = 0; i < probes; i++) {
+        uint64_t bit = h % n;
+        bits[bit / 64] |= 1ULL << (bit % 64);
+        h += delta;
+    }
+}
+
+bool RangeFilter::test(int shift, uint64_t prefix) const {
+    uint64_t h = mix(prefix ^ mix(shift));
+    uint64_t delta = (h >> 32) | 1;
+    uint64_t n = bits.size() * 64;
+    for (int i = 0; i < probes; i++) {
+        uint64_t bit = h % n;
+        if (!(bits[bit / 64] & (1ULL << (bit % 64)))) return false;
+        h += delta;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// A Bloom filter over the prefixes of the keys of a table at several
+// lengths: a key k is inserted as k >> s for every shift s in SHIFTS. A
+// query for [min, max] picks the smallest shift at which the range spans at
+// most MAX_PREFIXES prefixes and tests each of them, so narrow scans and
+// point lookups can skip a table without searching its index. Shift 0 makes
+// it a plain Bloom filter for single keys.
+class RangeFilter {
+   public:
+    RangeFilter() : probes(0) {}
+
+    // builds the filter of sorted keys with bitsPerKey bits for each
+    // distinct prefix
+    static RangeFilter build(const std::vector<uint64_t> &keys,
+                             uint64_t bitsPerKey);
+
+    bool empty() const { return bits.empty(); }
+
+    // false if no key of the table is in [min, max], true may be a false
+    // positive or a range too wide for the filter
+    bool mayContain(uint64_t min, uint64_t max) const;
+
+    uint64_t bytes() const { return bits.size() * 8; }
+
+   private:
+    static constexpr int SHIFTS[] = {0, 8, 16, 24, 32, 40};
+    static const uint64_t MAX_PREFIXES = 4;
+
+    std::vector<uint64_t> bits;
+    int probes;  // the number of bits set per prefix
+
+    void add(int shift, uint64_t prefix);
+
+    bool test(int shift, uint64_t prefix) const;
+};
@@ -0,0 +1,113 @@
+#include "row_cache.h"
+
+#include <algorithm>
+
+namespace {
+
+// splitmix64, spreads neighbouring keys over the sketch
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+}  // namespace
+
+RowCache::RowCache(uint64_t capacity)
+    : capacity(capacity), used(0), erasures(0), width(1024), lookups(0) {
+    // a counter for every value of about 128 bytes that fits
+    while (width < capacity / 128) width *= 2;
+    sketch.resize(SKETCH_ROWS * width, 0);
+    sampleSize = 10 * width;
+}
+
+std::shared_ptr<const std::string> RowCache::lookup(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    touch(key);
+    auto it = rows.find(key);
+    if (it == rows.end()) return nullptr;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+}
+
+void RowCache::insert(uint64_t key, std::string value, uint64_t version) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t size = entryBytes(value);
+    if (version != erasures || size > capacity) return;
+    auto it = rows.find(key);
+    // a new key has to be wanted more often than the value it pushes out,
+    // a cached one was admitted already and only gets its value replaced
+    if (it == rows.end() && used + size > capacity &&
+        frequency(key) <= frequency(lru.back().first))
+        return;
+    if (it != rows.end()) evict(it);
+    while (used + size > capacity) evict(rows.find(lru.back().first));
+    used += size;
+    lru.push_front(
+        {key, std::make_shared<const std::string>(std::move(value))});
+    rows[key] = lru.begin();
+}
+
+uint64_t RowCache::version() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return erasures;
+}
+
+void RowCache::erase(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    erasures++;
+    auto it = rows.find(key);
+    if (it != rows.end()) evict(it);
+}
+
+void RowCache::erase(uint64_t start, uint64_t end) {
+    std::lock_guard<std::mutex> lock(mutex);
+    erasures++;
+    auto it = rows.lower_bound(start);
+    while (it != rows.end() && it->first <= end) evict(it++);
+}
+
+void RowCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    erasures++;
+    rows.clear();
+    lru.clear();
+    used = 0;
+    std::fill(sketch.begin(), sketch.end(), 0);
+    lookups = 0;
+}
+
+uint64_t RowCache::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+void RowCache::touch(uint64_t key) {
+    for (int row = 0; row < SKETCH_ROWS; row++) {
+        uint8_t &count = sketch[slot(key, row)];
+        if (count < MAX_COUNT) count++;
+    }
+    if (++lookups < sampleSize) return;
+    for (auto &count : sketch) count /= 2;
+    lookups = 0;
+}
+
+uint8_t RowCache::frequency(uint64_t key) const {
+    uint8_t count = MAX_COUNT;
+    for (int row = 0; row < SKETCH_ROWS; row++)
+        count = std::min(count, sketch[slot(key, row)]);
+    return count;
+}
+
+uint64_t RowCache::slot(uint64_t key, int row) const {
+    uint64_t h = mix(key);
+    uint64_t delta = (h >> 32) | 1;
+    return row * width + ((h + row * delta) & (width - 1));
+}
+
+void RowCache::evict(std::map<uint64_t, Lru::iterator>::iterator it) {
+    used -= entryBytes(*it->second->second);
+    lru.erase(it->second);
+    rows.erase(it);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Values of keys read from the ss-tables, keyed by user key and bounded in
+// bytes. Keys are admitted TinyLFU style: a count-min sketch estimates how
+// often each key was looked up lately, and once the cache is full a new key
+// only takes the place of the least recently used one if it was looked up
+// more often, so a pass over cold keys doesn't flush the hot ones. The
+// counters are halved every few lookups per counter so that old popularity
+// fades.
+class RowCache {
+   public:
+    RowCache(uint64_t capacity);
+
+    // the value of key, nullptr if it isn't cached; counts the lookup
+    std::shared_ptr<const std::string> lookup(uint64_t key);
+
+    // Caches the value of key unless the admission policy turns it down or
+    // an entry was erased since version was taken, the value read may be
+    // stale then.
+    void insert(uint64_t key, std::string value, uint64_t version);
+
+    // changes on every erase, taken before a value is read for insert
+    uint64_t version() const;
+
+    // drops the values of keys that were written
+    void erase(uint64_t key);
+    void erase(uint64_t start, uint64_t end);
+
+    void clear();
+
+    // the bytes taken by cached values
+    uint64_t bytes() const;
+
+   private:
+    typedef std::list<std::pair<uint64_t, std::shared_ptr<const std::string>>>
+        Lru;
+
+    static const int SKETCH_ROWS = 4;
+    static const uint8_t MAX_COUNT = 15;
+
+    uint64_t capacity;
+    uint64_t used;
+    uint64_t erasures;
+    Lru lru;  // from the most recently used value
+    std::map<uint64_t, Lru::iterator> rows;
+    // SKETCH_ROWS rows of width counters, halved after sampleSize lookups
+    std::vector<uint8_t> sketch;
+    uint64_t width;
+    uint64_t lookups;
+    uint64_t sampleSize;
+    mutable std::mutex mutex;
+
+    // counts a lookup of key in the sketch
+    void touch(uint64_t key);
+
+    // the estimated number of recent lookups of key
+    uint8_t frequency(uint64_t key) const;
+
+    // the counter of key in row
+    uint64_t slot(uint64_t key, int row) const;
+
+    void evict(std::map<uint64_t, Lru::iterator>::iterator it);
+
+    static uint64_t entryBytes(const std::string &value) {
+        return value.size() + 2 * sizeof(uint64_t);
+    }
+};
@@ -0,0 +1,167 @@
+#include "sharded_kvstore.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+// splitmix64, spreads sequential keys over the shards
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+bool writeShardCount(const std::string &dir, int shards) {
+    std::filesystem::create_directories(dir);
+    std::ofstream fs((std::filesystem::path(dir) / "shards").string());
+    fs << shards << std::endl;
+    return (bool)fs;
+}
+
+// the number of shards dir was written with, 0 for a new store
+int readShardCount(const std::string &dir) {
+    std::ifstream fs((std::filesystem::path(dir) / "shards").string());
+    int shards = 0;
+    if (fs >> shards && shards > 0) return shards;
+    // a store written before the count was kept has a folder per shard
+    std::error_code ec;
+    while (std::filesystem::exists(
+        std::filesystem::path(dir) / ("shard-" + std::to_string(shards)), ec))
+        shards++;
+    return shards;
+}
+
+}  // namespace
+
+ShardedKVStore::ShardedKVStore(const std::string &dir, int shards,
+                               const Options &options)
+    : KVStoreAPI(dir) {
+    // the shards split their compactions over one pool rather than each
+    // starting a thread per core
+    Options shared = options;
+    int threads = options.maxSubcompactions;
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (!shared.compactionPool && threads > 1)
+        shared.compactionPool = std::make_shared<ThreadPool>(threads);
+    // keys would be routed to the wrong shards under another count, so a
+    // store keeps the one it was created with
+    int count = readShardCount(dir);
+    if (count == 0) {
+        count = std::max(1, shards);
+        if (!writeShardCount(dir, count))
+            std::clog << "error writing " << dir << "/shards" << std::endl;
+    } else if (count != shards) {
+        std::clog << dir << " has " << count << " shards, opening it with "
+                  << count << " rather than " << shards << std::endl;
+    }
+    for (int i = 0; i < count; i++) {
+        std::unique_ptr<Shard> shard(new Shard);
+        shard->store = std::unique_ptr<KVStore>(new KVStore(
+            (std::filesystem::path(dir) / ("shard-" + std::to_string(i)))
+                .string(),
+            shared));
+        this->shards.push_back(std::move(shard));
+    }
+}
+
+ShardedKVStore::Shard &ShardedKVStore::shardOf(uint64_t key) {
+    return *shards[mix(key) % shards.size()];
+}
+
+void ShardedKVStore::put(uint64_t key, const std::string &s) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.store->put(key, s);
+}
+
+void ShardedKVStore::put(uint64_t key, const std::string &s, uint64_t ttl) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.store->put(key, s, ttl);
+}
+
+std::string ShardedKVStore::get(uint64_t key) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.store->get(key);
+}
+
+bool ShardedKVStore::del(uint64_t key) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.store->del(key);
+}
+
+void ShardedKVStore::scan(uint64_t key1, uint64_t key2,
+                          std::list<std::pair<uint64_t, std::string>> &list) {
+    // each shard returns its keys in order and no key is in two shards
+    std::list<std::pair<uint64_t, std::string>> merged;
+    for (auto &shard : shards) {
+        std::list<std::pair<uint64_t, std::string>> part;
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->store->scan(key1, key2, part);
+        }
+        merged.merge(part, [](const std::pair<uint64_t, std::string> &a,
+                              const std::pair<uint64_t, std::string> &b) {
+            return a.first < b.first;
+        });
+    }
+    list.splice(list.end(), merged);
+}
+
+void ShardedKVStore::deleteRange(uint64_t start, uint64_t end) {
+    for (auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->store->deleteRange(start, end);
+    }
+}
+
+void ShardedKVStore::resetAsync() {
+    for (auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->store->resetAsync();
+    }
+}
+
+bool ShardedKVStore::createCheckpoint(const std::string &dir) {
+    bool ok = true;
+    for (size_t i = 0; i < shards.size(); i++) {
+        std::lock_guard<std::mutex> lock(shards[i]->mutex);
+        ok = shards[i]->store->createCheckpoint(
+                 (std::filesystem::path(dir) / ("shard-" + std::to_string(i)))
+                     .string()) &&
+             ok;
+    }
+    return ok && writeShardCount(dir, shards.size());
+}
+
+void ShardedKVStore::reset() {
+    for (auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->store->reset();
+    }
+}
+
+Stats ShardedKVStore::getStats() const {
+    Stats stats;
+    for (auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        stats += shard->store->getStats();
+    }
+    return stats;
+}
+
+uint64_t ShardedKVStore::sizeOnDisk() const {
+    uint64_t bytes = 0;
+    for (auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        bytes += shard->store->sizeOnDisk();
+    }
+    return bytes;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "kvstore.h"
+
+// N independent KVStores under dir/shard-<i>, each with its own memTable,
+// tables and compaction. Keys are hash partitioned over the shards, so the
+// number of shards is kept in dir/shards and a store is always reopened
+// with the number it was created with.
+// Every operation locks only the shard of its key, which lets threads
+// working on different shards run in parallel; unlike a KVStore all
+// operations may be called from several threads at once. A scan visits the
+// shards one after another and is not a snapshot across them.
+class ShardedKVStore : public KVStoreAPI {
+   public:
+    ShardedKVStore(const std::string &dir, int shards,
+                   const Options &options = Options());
+
+    void put(uint64_t key, const std::string &s) override;
+
+    // puts key with an entry that expires ttl seconds from now
+    void put(uint64_t key, const std::string &s, uint64_t ttl);
+
+    std::string get(uint64_t key) override;
+
+    bool del(uint64_t key) override;
+
+    // merges the keys in [key1, key2] of all shards in order
+    void scan(uint64_t key1, uint64_t key2,
+              std::list<std::pair<uint64_t, std::string>> &list) override;
+
+    // deletes the keys in [start, end] in every shard
+    void deleteRange(uint64_t start, uint64_t end);
+
+    void reset() override;
+
+    void resetAsync();
+
+    // checkpoints every shard into dir/shard-<i>, one shard after another
+    bool createCheckpoint(const std::string &dir);
+
+    int size() const { return shards.size(); }
+
+    // the counters of all shards added up
+    Stats getStats() const;
+
+    // the total size in bytes of all shards
+    uint64_t sizeOnDisk() const;
+
+   private:
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unique_ptr<KVStore> store;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    Shard &shardOf(uint64_t key);
+};
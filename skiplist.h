@@ -1,5 +1,6 @@
 #include <iostream>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #ifndef SKIPLIST_H
@@ -8,7 +9,7 @@
 template <typename Key, typename Value>
 class SkipList {
    public:
-    struct Node {
+    struct Node : std::enable_shared_from_this<Node> {
         Key key;
         Value val;
         std::shared_ptr<Node> pred;
@@ -22,7 +23,10 @@ class SkipList {
         }
     };
 
-    SkipList();
+    // With hashIndex set, a hash table from each key to its tower serves
+    // get, remove and updates of existing keys in O(1), the list still keeps
+    // the keys ordered for exportData.
+    SkipList(bool hashIndex = false);
     bool put(Key key, Value value);
     
     Value* get(Key key) const;
@@ -33,6 +37,10 @@ class SkipList {
     
     // return an array of Nodes, including Key and Value
     std::shared_ptr<Node> exportData();
+
+    // calls f on every element with a key in [min, max] in order
+    template <typename F>
+    void scan(Key min, Key max, F f) const;
     
     // if the node is neither a head nor a tail and it's not nullptr, it's valid
     bool valid(std::shared_ptr<typename SkipList<Key, Value>::Node>) const;
@@ -50,6 +58,9 @@ class SkipList {
     std::shared_ptr<Node> head;
     std::shared_ptr<Node> tail;
     unsigned level;
+    bool hashIndex;
+    // the top node of the tower of each key, empty without hashIndex
+    std::unordered_map<Key, std::shared_ptr<Node>> towers;
 };
 
 template <typename Key, typename Value>
@@ -77,7 +88,8 @@ bool SkipList<Key, Value>::test() const {
 }
 
 template <typename Key, typename Value>
-SkipList<Key, Value>::SkipList() : level(1) {
+SkipList<Key, Value>::SkipList(bool hashIndex)
+    : level(1), hashIndex(hashIndex) {
     srand(time(nullptr));
     head = std::shared_ptr<Node>(new Node());
     tail = std::shared_ptr<Node>(new Node());
@@ -87,6 +99,13 @@ SkipList<Key, Value>::SkipList() : level(1) {
 
 template <typename Key, typename Value>
 bool SkipList<Key, Value>::put(Key key, Value value) {
+    if (hashIndex) {
+        auto it = towers.find(key);
+        if (it != towers.end()) {
+            for (auto ptr = it->second; ptr; ptr = ptr->below) ptr->val = value;
+            return true;
+        }
+    }
     std::shared_ptr<Node> newNode(new Node(key, value));
     std::shared_ptr<Node> ptr = skipSearch(key);  // nearest element's top level
     // if the key exists, then update its value
@@ -132,11 +151,16 @@ bool SkipList<Key, Value>::put(Key key, Value value) {
         newNode->above = growNode;
         newNode = growNode;
     }
+    if (hashIndex) towers[key] = newNode;
     return true;
 }
 
 template <typename Key, typename Value>
 Value* SkipList<Key, Value>::get(Key key) const {
+    if (hashIndex) {
+        auto it = towers.find(key);
+        return it == towers.end() ? nullptr : &it->second->val;
+    }
     std::shared_ptr<Node> temp = skipSearch(key);
     if (valid(temp) && temp->key == key) return &temp->val;
     return nullptr;
@@ -144,8 +168,16 @@ Value* SkipList<Key, Value>::get(Key key) const {
 
 template <typename Key, typename Value>
 bool SkipList<Key, Value>::remove(Key key, std::shared_ptr<Value> backupVal) {
-    std::shared_ptr<Node> ptr = skipSearch(key);
-    if (!valid(ptr) || ptr->key != key) return false;
+    std::shared_ptr<Node> ptr;
+    if (hashIndex) {
+        auto it = towers.find(key);
+        if (it == towers.end()) return false;
+        ptr = it->second;
+        towers.erase(it);
+    } else {
+        ptr = skipSearch(key);
+        if (!valid(ptr) || ptr->key != key) return false;
+    }
     if (backupVal) *backupVal = ptr->val;
     while (ptr) {
         ptr->pred->succ = ptr->succ;
@@ -184,46 +216,47 @@ std::ostream& operator<<(std::ostream& os, const SkipList<Key, Value>& l) {
 template <typename Key, typename Value>
 std::shared_ptr<typename SkipList<Key, Value>::Node>
 SkipList<Key, Value>::skipSearch(Key key) const {
-    std::shared_ptr<Node> temp = head->succ;
-    std::shared_ptr<Node> levelHead = head;  // marks the head of current level
-    std::vector<Key> path;
+    // walks raw pointers, the list owns the nodes while it's searched
+    Node *temp = head->succ.get();
+    Node *levelHead = head.get();  // marks the head of current level
     while (temp) {
-        while ((temp->succ && temp->key <= key) || temp == levelHead) {
-            temp = temp->succ;
-            path.push_back(temp->key);
-        }
+        while ((temp->succ && temp->key <= key) || temp == levelHead)
+            temp = temp->succ.get();
         if (!temp->pred) {
             std::cerr << *this << '\n';
             std::cerr << "ERR with key " << key << '\n';
             std::cerr << "level head @" << levelHead << '\n';
-            for (auto n = path.begin(); n != path.end(); n++) {
-                std::cout << *n << '\t';
-            }
-            std::cout << '\n';
         }
-        temp = temp->pred;
+        temp = temp->pred.get();
 
-        path.push_back(temp->key);
         // find a match
         // temp->pred is to prevent visiting head's
-        if (temp && temp->pred && temp->key == key && valid(temp)) {
-            return temp;
-        }
+        if (temp->pred && temp->succ && temp->key == key)
+            return temp->shared_from_this();
         // return if no lower level exists
-        if (!levelHead->below) return temp;
+        if (!levelHead->below) return temp->shared_from_this();
         // go to lower level or the head of lower level
-        if (temp->below) {
-            temp = temp->below;
-            path.push_back(temp->key);
-        } else
-            temp = levelHead->below;
-        levelHead = levelHead->below;
-        // if (!temp->below) return temp;
-        // temp = temp->below;
+        if (temp->below)
+            temp = temp->below.get();
+        else
+            temp = levelHead->below.get();
+        levelHead = levelHead->below.get();
     }
     return nullptr;
 }
 
+template <typename Key, typename Value>
+template <typename F>
+void SkipList<Key, Value>::scan(Key min, Key max, F f) const {
+    std::shared_ptr<Node> ptr = skipSearch(min);
+    if (!ptr) return;
+    while (ptr->below) ptr = ptr->below;
+    // skipSearch stops at the nearest smaller element or the head
+    if (!valid(ptr) || ptr->key < min) ptr = ptr->succ;
+    for (; valid(ptr) && ptr->key <= max; ptr = ptr->succ)
+        f(ptr->key, ptr->val);
+}
+
 template <typename Key, typename Value>
 bool SkipList<Key, Value>::valid(
     std::shared_ptr<typename SkipList<Key, Value>::Node> node) const {
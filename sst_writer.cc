@@ -0,0 +1,171 @@
+#include "sst_writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <queue>
+
+#include "table_builder.h"
+
+namespace {
+
+// reads back a run file of key|length|value records
+class RunReader {
+   public:
+    RunReader(const std::string &path)
+        : valid(false), fs(path, std::ios::binary) {
+        next();
+    }
+
+    bool valid;
+    uint64_t key;
+    std::string val;
+
+    void next() {
+        uint64_t len = 0;
+        valid = fs.read(reinterpret_cast<char *>(&key), 8) &&
+                fs.read(reinterpret_cast<char *>(&len), 8);
+        if (!valid) return;
+        val.resize(len);
+        valid = (bool)fs.read(&val[0], len);
+    }
+
+   private:
+    std::ifstream fs;
+};
+
+}  // namespace
+
+SstWriter::SstWriter(const std::string &dir, const Options &options,
+                     uint64_t memoryBytes, uint64_t tableSize)
+    : dir(dir),
+      options(options),
+      memoryBytes(memoryBytes),
+      tableSize(tableSize),
+      runBytes(0),
+      spillFailed(false) {
+    std::filesystem::create_directories(dir);
+}
+
+SstWriter::~SstWriter() {
+    for (auto &path : spilled) std::filesystem::remove(path);
+}
+
+void SstWriter::add(uint64_t key, const std::string &val) {
+    run.push_back({key, val});
+    // the key, the string and its buffer
+    runBytes += 16 + sizeof(std::string) + val.length();
+    if (runBytes >= memoryBytes) spill();
+}
+
+void SstWriter::sortRun() {
+    std::stable_sort(run.begin(), run.end(),
+                     [](const std::pair<uint64_t, std::string> &a,
+                        const std::pair<uint64_t, std::string> &b) {
+                         return a.first < b.first;
+                     });
+    // keeps the last entry of a key, which is the last of its equal ones
+    size_t n = 0;
+    for (size_t i = 0; i < run.size(); i++) {
+        if (i + 1 < run.size() && run[i + 1].first == run[i].first) continue;
+        if (n != i) run[n] = std::move(run[i]);
+        n++;
+    }
+    run.resize(n);
+}
+
+void SstWriter::spill() {
+    sortRun();
+    std::string path =
+        (std::filesystem::path(dir) / ("run-" + std::to_string(spilled.size())))
+            .string();
+    std::ofstream fs(path, std::ios::binary | std::ios::trunc);
+    std::vector<char> buf(options.tableWriteBuffer);
+    fs.rdbuf()->pubsetbuf(buf.data(), buf.size());
+    for (auto &p : run) {
+        uint64_t len = p.second.length();
+        fs.write(reinterpret_cast<const char *>(&p.first), 8);
+        fs.write(reinterpret_cast<const char *>(&len), 8);
+        fs.write(p.second.data(), len);
+    }
+    fs.close();
+    if (!fs) {
+        std::clog << "[SstWriter] Failed to write " << path << std::endl;
+        spillFailed = true;
+    }
+    spilled.push_back(path);
+    run.clear();
+    runBytes = 0;
+}
+
+std::vector<std::string> SstWriter::finish() {
+    std::vector<std::string> paths;
+    int64_t writeTime = time(nullptr);
+    std::unique_ptr<TableBuilder> builder;
+    bool failed = false;
+    auto emit = [&](uint64_t key, const std::string &val) {
+        if (!builder) {
+            paths.push_back((std::filesystem::path(dir) /
+                             ("sstable-" + std::to_string(paths.size())))
+                                .string());
+            builder = std::unique_ptr<TableBuilder>(
+                new TableBuilder(paths.back(), options.tableWriteBuffer, false,
+                                 nullptr, options.learnedIndexError,
+                                 options.compactTables));
+        }
+        builder->add(key, writeTime, val);
+        if (builder->size() >= tableSize) {
+            if (builder->finish(options.syncTables).empty()) failed = true;
+            builder.reset();
+        }
+    };
+    if (spilled.empty()) {
+        // everything fit in memory
+        sortRun();
+        for (auto &p : run) emit(p.first, p.second);
+        run.clear();
+    } else {
+        if (!run.empty()) spill();
+        // the entries of a run that couldn't be written are lost
+        if (spillFailed) {
+            std::error_code ec;
+            for (auto &path : spilled) std::filesystem::remove(path, ec);
+            spilled.clear();
+            return {};
+        }
+        // merges the runs, of equal keys the one of the newest run wins
+        std::vector<std::unique_ptr<RunReader>> readers;
+        for (auto &path : spilled)
+            readers.push_back(std::unique_ptr<RunReader>(new RunReader(path)));
+        auto later = [&](size_t a, size_t b) {
+            if (readers[a]->key != readers[b]->key)
+                return readers[a]->key > readers[b]->key;
+            return a < b;
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(
+            later);
+        for (size_t i = 0; i < readers.size(); i++)
+            if (readers[i]->valid) heap.push(i);
+        bool first = true;
+        uint64_t last = 0;
+        while (!heap.empty()) {
+            size_t i = heap.top();
+            heap.pop();
+            RunReader &r = *readers[i];
+            if (first || r.key != last) emit(r.key, r.val);
+            first = false;
+            last = r.key;
+            r.next();
+            if (r.valid) heap.push(i);
+        }
+        for (auto &path : spilled) std::filesystem::remove(path);
+        spilled.clear();
+    }
+    if (builder && builder->finish(options.syncTables).empty()) failed = true;
+    if (options.syncTables) syncDir(dir);
+    if (failed) return {};
+    return paths;
+}
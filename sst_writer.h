@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "options.h"
+
+// Builds ss-tables outside a store, to be moved into one by
+// KVStore::ingestFiles. Entries may be added in any order: they are sorted
+// in memory in runs of at most memoryBytes, runs that don't fit are spilled
+// to files in dir, and finish merges the runs into tables of about
+// tableSize bytes. Of several entries of a key the last one added wins, and
+// all entries are stamped with the time finish is called.
+class SstWriter {
+   public:
+    SstWriter(const std::string &dir, const Options &options = Options(),
+              uint64_t memoryBytes = 64 * 1024 * 1024,
+              uint64_t tableSize = 2 * 1024 * 1024);
+
+    ~SstWriter();
+
+    void add(uint64_t key, const std::string &val);
+
+    // writes the tables and returns their paths in key order, empty if a
+    // run or a table couldn't be written
+    std::vector<std::string> finish();
+
+   private:
+    std::string dir;
+    Options options;
+    uint64_t memoryBytes;
+    uint64_t tableSize;
+
+    std::vector<std::pair<uint64_t, std::string>> run;  // not yet sorted
+    uint64_t runBytes;
+    std::vector<std::string> spilled;  // run files, from the oldest
+    bool spillFailed;  // a run file couldn't be written
+
+    // sorts the run in memory, keeping the last entry of each key
+    void sortRun();
+
+    // writes the sorted run to a file
+    void spill();
+};
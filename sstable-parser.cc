@@ -1,8 +1,26 @@
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <vector>
 // #include <
 
+// TableBuilder::COMPACT_MAGIC, the table has delta keys and varint headers
+const uint64_t COMPACT_MAGIC = 0x746361706d6f43f0ULL;
+// TableBuilder::PROPERTIES_MAGIC, a properties block ends the table
+const uint64_t PROPERTIES_MAGIC = 0x73656974f0706f72ULL;
+
+uint64_t readVarint(std::ifstream &fs) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int b = fs.get();
+        if (b == EOF) break;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) break;
+    }
+    return v;
+}
+
 std::string printTime(const time_t rawtime) {
     struct tm *dt;
     char buffer[30];
@@ -11,7 +29,41 @@ std::string printTime(const time_t rawtime) {
     return std::string(buffer);
 }
 
-void readTable(std::string root, int level, int id, uint64_t t_key = UINT64_MAX) {
+// reads the fields of the properties block of the table in fs, returns
+// where the table ends without the block
+uint64_t readProperties(std::ifstream &fs, std::vector<uint64_t> &fields) {
+    fs.seekg(0, std::ios::end);
+    uint64_t size = fs.tellg();
+    uint64_t tail[2] = {0, 0};  // the offset of the block and the magic
+    if (size < 24) return size;
+    fs.seekg(size - 16);
+    fs.read(reinterpret_cast<char *>(tail), sizeof(tail));
+    if (tail[1] != PROPERTIES_MAGIC || tail[0] + 8 > size - 16) return size;
+    fields.resize((size - 16 - tail[0]) / 8);
+    fs.seekg(tail[0]);
+    fs.read(reinterpret_cast<char *>(fields.data()), fields.size() * 8);
+    // the number of fields
+    fields.erase(fields.begin());
+    return tail[0];
+}
+
+void printProperties(const std::vector<uint64_t> &p) {
+    if (p.size() < 10) {
+        std::cout << "[properties] none" << std::endl;
+        return;
+    }
+    std::cout << "[properties] " << p[0] << " entries, " << p[1]
+              << " tombstones, keys [" << p[2] << ", " << p[3] << "], "
+              << p[4] << " raw bytes, " << p[5] << " data bytes, " << p[6]
+              << " index bytes, times [" << printTime(p[7]) << ", "
+              << printTime(p[8]) << "], created " << printTime(p[9]);
+    if (p.size() > 10) std::cout << ", sequence " << p[10];
+    std::cout << std::endl;
+}
+
+// prints the entries of a table, or only its properties with summary set
+void readTable(std::string root, int level, int id,
+               uint64_t t_key = UINT64_MAX, bool summary = false) {
     std::string file = root + '/' + "level-" + std::to_string(level) +
                        "/sstable-" + std::to_string(id);
     if (level == -1) file = root + '/' + "tmp/sstable-" + std::to_string(id);
@@ -20,34 +72,78 @@ void readTable(std::string root, int level, int id, uint64_t t_key = UINT64_MAX)
         return;
     }
     std::ifstream fs(file, std::ios::binary);
-    fs.seekg(-8, std::ios::end);
+    std::vector<uint64_t> properties;
+    uint64_t end = readProperties(fs, properties);
+    if (summary) {
+        printProperties(properties);
+        return;
+    }
+    fs.seekg(end - 16);
+    uint64_t magic = 0;
+    fs.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+    bool compact = magic == COMPACT_MAGIC;
     uint64_t index = 0;
     fs.read(reinterpret_cast<char *>(&index), sizeof(index));
     fs.seekg(index);
     std::basic_istream<char, std::char_traits<char>>::pos_type indexTablePos =
         fs.tellg();
     fs.seekg(std::ios::beg);
-    std::cout << "[meta] indexTable @" << indexTablePos << std::endl;
+    std::cout << "[meta] indexTable @" << indexTablePos
+              << (compact ? " compact" : "") << std::endl;
+    printProperties(properties);
+    uint64_t key = 0;
     while (fs.tellg() < indexTablePos) {
         int offest = fs.tellg();
-        uint64_t key = 0;
         uint64_t len = 0;
         time_t time = 0;
-        fs.read(reinterpret_cast<char *>(&key), sizeof(key));
-        fs.read(reinterpret_cast<char *>(&time), sizeof(time));
-        fs.read(reinterpret_cast<char *>(&len), sizeof(len));
+        bool indirect = false;
+        if (compact) {
+            // the key is a delta from the previous one, the low bit of the
+            // length marks a pointer into the value log
+            key += readVarint(fs);
+            time = readVarint(fs);
+            len = readVarint(fs);
+            indirect = len & 1;
+            len >>= 1;
+        } else {
+            fs.read(reinterpret_cast<char *>(&key), sizeof(key));
+            fs.read(reinterpret_cast<char *>(&time), sizeof(time));
+            fs.read(reinterpret_cast<char *>(&len), sizeof(len));
+            // the top bit marks a pointer into the value log
+            indirect = len >> 63;
+            len &= ~(1ULL << 63);
+        }
         char *str = new char[len + 1];
         fs.read(str, len);
         str[len] = '\0';
         if (t_key != UINT64_MAX && t_key != key) continue;
+        // bit 62 of the time marks a put with a ttl, its value starts with
+        // the time it expires at
+        const char *v = str;
+        time_t expiresAt = 0;
+        if ((time & (1LL << 62)) && len >= 8) {
+            time &= ~(1LL << 62);
+            memcpy(&expiresAt, str, 8);
+            v += 8;
+            len -= 8;
+        }
+        std::string val(v, 0, 40);
+        if (indirect && len == 24) {
+            uint64_t p[3];
+            memcpy(p, v, sizeof(p));
+            val = "vlog-" + std::to_string(p[0]) + " @" + std::to_string(p[1]) +
+                  " [" + std::to_string(p[2]) + "]";
+        }
+        delete[] str;
+        if (expiresAt) val += " (expires " + printTime(expiresAt) + ")";
         std::cout << "<" << offest << "> " << printTime((time)) << "\t" << key
-                  << ": [" << len << "] " << std::string(str, 0, 40)
-                  << std::endl;
+                  << ": [" << len << "] " << val << std::endl;
     }
     fs.close();
 }
 
-void readAll(std::string root, uint64_t key = UINT64_MAX) {
+void readAll(std::string root, uint64_t key = UINT64_MAX,
+             bool summary = false) {
     // std::string level = "";
     int lv = 0;
     int count = 0;
@@ -57,7 +153,7 @@ void readAll(std::string root, uint64_t key = UINT64_MAX) {
         while (std::filesystem::exists(filename)) {
             std::cout << std::endl << "### " << filename << std::endl;
             // parse the file
-            readTable(root, lv, count, key);
+            readTable(root, lv, count, key, summary);
             filename = level + "/sstable-" + std::to_string(++count);
         }
         count = 0;
@@ -69,7 +165,7 @@ void readAll(std::string root, uint64_t key = UINT64_MAX) {
         while (std::filesystem::exists(filename)) {
             std::cout << std::endl << "### " << filename << std::endl;
             // parse the file
-            readTable(root, -1, count, key);
+            readTable(root, -1, count, key, summary);
             filename = root + "/tmp" + "/sstable-" + std::to_string(++count);
         }
     }
@@ -85,6 +181,10 @@ int main(int argc, char *argv[]) {
             readAll(argv[2]);
     }
 
+    else if (mode == "-p") {
+        readAll(argv[2], UINT64_MAX, true);
+    }
+
     else if (mode == "-t") {
         if (argc < 5) {
             std::cout << "Usage -t root lv id" << std::endl;
@@ -0,0 +1,307 @@
+#include "table_builder.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <thread>
+
+RateLimiter::RateLimiter(uint64_t bytesPerSecond)
+    : rate(bytesPerSecond),
+      burst(bytesPerSecond / 10.0),
+      available(0),
+      last(std::chrono::steady_clock::now()) {}
+
+void RateLimiter::refill() {
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - last;
+    available = std::min(burst, available + elapsed.count() * rate);
+    last = now;
+}
+
+void RateLimiter::request(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    refill();
+    available -= bytes;
+    if (available < 0) {
+        // pays the debt off by sleeping, other writers queue up behind
+        std::this_thread::sleep_for(
+            std::chrono::duration<double>(-available / rate));
+        refill();
+    }
+}
+
+TableBuilder::TableBuilder(const std::string &path, size_t bufferSize,
+                           bool direct, RateLimiter *limiter,
+                           uint64_t modelError, bool compact,
+                           bool pipelined)
+    : path(path),
+      direct(direct),
+      failed(false),
+      limiter(limiter),
+      modelError(modelError),
+      compact(compact),
+      spare(nullptr),
+      used(0),
+      written(0),
+      offset(0),
+      writeFailed(false) {
+    // the buffer is flushed in whole blocks, O_DIRECT needs them aligned
+    bufSize = std::max(ALIGNMENT, bufferSize / ALIGNMENT * ALIGNMENT);
+    buf = static_cast<char *>(std::aligned_alloc(ALIGNMENT, bufSize));
+    if (pipelined) {
+        spare = static_cast<char *>(std::aligned_alloc(ALIGNMENT, bufSize));
+        writer = std::unique_ptr<ThreadPool>(new ThreadPool(1));
+    }
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    fd = -1;
+#ifdef O_DIRECT
+    if (direct) fd = open(path.c_str(), flags | O_DIRECT, 0644);
+#endif
+    // falls back to buffered io, e.g. on a file system without O_DIRECT
+    if (fd < 0) {
+        this->direct = false;
+        fd = open(path.c_str(), flags, 0644);
+    }
+    if (fd < 0)
+        std::clog << "[TableBuilder] Failed to open sstable file " << path
+                  << std::endl;
+}
+
+TableBuilder::~TableBuilder() {
+    waitWrite();
+    writer.reset();
+    if (fd >= 0) close(fd);
+    std::free(buf);
+    std::free(spare);
+}
+
+void TableBuilder::append(const void *data, size_t n) {
+    const char *p = static_cast<const char *>(data);
+    while (n > 0) {
+        size_t len = std::min(n, bufSize - used);
+        memcpy(buf + used, p, len);
+        used += len;
+        p += len;
+        n -= len;
+        if (used == bufSize) flush(false);
+    }
+}
+
+void TableBuilder::flush(bool final) {
+    waitWrite();
+    if (!ok()) {
+        used = 0;
+        return;
+    }
+    size_t len = final ? used : used / ALIGNMENT * ALIGNMENT;
+    if (writer && !final) {
+        // the full blocks go to the writer, the tail starts the other buffer
+        memcpy(spare, buf + len, used - len);
+        std::swap(buf, spare);
+        const char *data = spare;
+        uint64_t at = written;
+        pending = writer->submit([this, data, len, at] {
+            if (!writeAt(data, len, at)) writeFailed = true;
+        });
+        written += len;
+        used -= len;
+        return;
+    }
+    // O_DIRECT writes whole blocks, the file is truncated afterwards
+    size_t padded = len;
+    if (direct) padded = (len + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    if (padded > len) memset(buf + len, 0, padded - len);
+    if (!writeAt(buf, padded, written)) {
+        failed = true;
+        return;
+    }
+    if (padded > len && ftruncate(fd, written + len) != 0) failed = true;
+    written += len;
+    // keeps the unaligned tail for the next write
+    memmove(buf, buf + len, used - len);
+    used -= len;
+}
+
+bool TableBuilder::writeAt(const char *data, size_t n, uint64_t at) {
+    if (limiter && n > 0) limiter->request(n);
+    size_t done = 0;
+    while (done < n) {
+        ssize_t w = pwrite(fd, data + done, n - done, at + done);
+        if (w <= 0) {
+            std::clog << "[TableBuilder] Failed to write " << path
+                      << std::endl;
+            return false;
+        }
+        done += w;
+    }
+#ifdef SYNC_FILE_RANGE_WRITE
+    // starts the writeback without waiting for it
+    if (writer && n > 0) sync_file_range(fd, at, n, SYNC_FILE_RANGE_WRITE);
+#endif
+    return true;
+}
+
+void TableBuilder::waitWrite() {
+    if (!pending.valid()) return;
+    pending.get();
+    if (writeFailed) failed = true;
+}
+
+void TableBuilder::add(uint64_t key, int64_t time, const std::string &val,
+                       bool indirect, int64_t expiresAt) {
+    uint64_t len = val.length();
+    if (props.entries == 0) {
+        props.minKey = key;
+        props.minTime = props.maxTime = time;
+    }
+    props.entries++;
+    if (len == 0 && !indirect) props.tombstones++;
+    props.maxKey = key;
+    props.rawBytes += sizeof(key) + len;
+    props.minTime = std::min(props.minTime, time);
+    props.maxTime = std::max(props.maxTime, time);
+    // the expiry is part of the value as far as the format goes
+    uint64_t stored = expiresAt ? len + sizeof(expiresAt) : len;
+    int64_t timeField = expiresAt ? (int64_t)((uint64_t)time | EXPIRING) : time;
+    // caches index data
+    offsets.push_back(offset);
+    if (compact) {
+        std::string header;
+        putCompactHeader(header, keys.empty() ? key : key - keys.back(),
+                         timeField, stored, indirect);
+        append(header.data(), header.length());
+        if (expiresAt) append(&expiresAt, sizeof(expiresAt));
+        append(val.data(), len);
+        keys.push_back(key);
+        offset += header.length() + stored;
+        return;
+    }
+    uint64_t lenField = indirect ? stored | VALUE_POINTER : stored;
+    char header[24];
+    memcpy(header, &key, 8);
+    memcpy(header + 8, &timeField, 8);
+    memcpy(header + 16, &lenField, 8);
+    append(header, sizeof(header));
+    if (expiresAt) append(&expiresAt, sizeof(expiresAt));
+    append(val.data(), len);
+    keys.push_back(key);
+    offset += sizeof(header) + stored;
+}
+
+void TableBuilder::finishCompact() {
+    std::vector<uint64_t> blocks;
+    std::string block;
+    uint64_t indexBytes = 0;
+    for (size_t i = 0; i < keys.size(); i += INDEX_BLOCK_ENTRIES) {
+        block.clear();
+        size_t end = std::min(keys.size(), (size_t)(i + INDEX_BLOCK_ENTRIES));
+        for (size_t j = i; j < end; j++) {
+            putVarint(block, j == i ? keys[j] : keys[j] - keys[j - 1]);
+            putVarint(block, j == i ? offsets[j] : offsets[j] - offsets[j - 1]);
+        }
+        blocks.push_back(indexBytes);
+        append(block.data(), block.length());
+        indexBytes += block.length();
+    }
+    for (uint64_t b : blocks) append(&b, sizeof(b));
+    uint64_t entries = keys.size();
+    append(&entries, sizeof(entries));
+    append(&COMPACT_MAGIC, sizeof(COMPACT_MAGIC));
+}
+
+IndexTable TableBuilder::finish(bool sync) {
+    // writes index data to file
+    if (compact) finishCompact();
+    for (size_t i = 0; !compact && i < keys.size(); i++) {
+        append(&keys[i], sizeof(keys[i]));
+        append(&offsets[i], sizeof(offsets[i]));
+    }
+    LinearModel model;
+    if (modelError > 0 && !compact)
+        model = LinearModel::build(keys, modelError);
+    // the model isn't worth it if the keys are far from linear
+    if (model.bytes() * 4 > keys.size() * 16) model = LinearModel();
+    if (!model.empty()) {
+        std::string m = model.encode();
+        append(m.data(), m.length());
+        append(&MODEL_MAGIC, sizeof(MODEL_MAGIC));
+    }
+    // writes meta data: the offset of the index table
+    append(&offset, sizeof(offset));
+    uint64_t footerEnd = written + used;
+    props.present = true;
+    props.dataBytes = offset;
+    props.indexBytes = footerEnd - offset;
+    props.createdAt = time(nullptr);
+    uint64_t block[PROPERTIES_FIELDS + 3] = {
+        PROPERTIES_FIELDS, props.entries, props.tombstones,
+        props.minKey, props.maxKey, props.rawBytes,
+        props.dataBytes, props.indexBytes, (uint64_t)props.minTime,
+        (uint64_t)props.maxTime, (uint64_t)props.createdAt,
+        (uint64_t)props.sequence, footerEnd, PROPERTIES_MAGIC};
+    append(block, sizeof(block));
+    flush(true);
+    if (sync && ok() && fdatasync(fd) != 0) failed = true;
+    if (!ok()) return IndexTable({}, {}, 0, 0);
+    IndexTable table(keys, offsets, offset, written, model);
+    table.compact = compact;
+    table.footerEnd = footerEnd;
+    table.properties = props;
+    return table;
+}
+
+uint64_t TableBuilder::readProperties(int fd, uint64_t size,
+                                      TableProperties &props) {
+    uint64_t tail[2] = {0, 0};  // the footer end and the magic number
+    if (size < 24 || pread(fd, tail, sizeof(tail), size - 16) != 16 ||
+        tail[1] != PROPERTIES_MAGIC || tail[0] + 8 > size - 16)
+        return size;
+    std::vector<uint64_t> block((size - 16 - tail[0]) / 8);
+    if (pread(fd, block.data(), block.size() * 8, tail[0]) !=
+            (ssize_t)(block.size() * 8) ||
+        block[0] + 1 > block.size())
+        return size;
+    // fields added later are missing in older tables
+    block.resize(PROPERTIES_FIELDS + 1, 0);
+    props.present = true;
+    props.entries = block[1];
+    props.tombstones = block[2];
+    props.minKey = block[3];
+    props.maxKey = block[4];
+    props.rawBytes = block[5];
+    props.dataBytes = block[6];
+    props.indexBytes = block[7];
+    props.minTime = block[8];
+    props.maxTime = block[9];
+    props.createdAt = block[10];
+    props.sequence = block[11];
+    return tail[0];
+}
+
+bool TableBuilder::writeSequence(const std::string &path, int64_t sequence,
+                                 bool sync) {
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) return false;
+    TableProperties props;
+    uint64_t size = lseek(fd, 0, SEEK_END);
+    uint64_t start = readProperties(fd, size, props);
+    // the sequence is field 11 of the block, after the number of fields
+    uint64_t n = 0;
+    bool ok = start < size && pread(fd, &n, 8, start) == 8 && n >= 11 &&
+              pwrite(fd, &sequence, 8, start + 11 * 8) == 8 &&
+              (!sync || fdatasync(fd) == 0);
+    close(fd);
+    return ok;
+}
+
+void syncDir(const std::string &dir) {
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "thread_pool.h"
+
+// A token bucket shared by the writers it throttles
+class RateLimiter {
+   public:
+    RateLimiter(uint64_t bytesPerSecond);
+
+    // blocks until bytes may be written
+    void request(uint64_t bytes);
+
+   private:
+    double rate;   // bytes per second
+    double burst;  // the most bytes saved up while idle
+    double available;
+    std::chrono::steady_clock::time_point last;
+    std::mutex mutex;
+
+    void refill();
+};
+
+// Writes an ss-table (see README.md) through a user-space buffer that is
+// flushed in aligned blocks. With direct set the file is opened with O_DIRECT
+// and bypasses the page cache, so a compaction doesn't evict the data gets
+// are reading. Entries must be added in key order.
+class TableBuilder {
+   public:
+    static constexpr size_t ALIGNMENT = 4096;
+
+    // precedes the offset of the index table in a table with a model
+    static constexpr uint64_t MODEL_MAGIC = 0x6c6564f04d6f6465ULL;
+
+    // precedes the offset of the index table in a compact table
+    static constexpr uint64_t COMPACT_MAGIC = 0x746361706d6f43f0ULL;
+
+    // ends a table with a properties block after its footer:
+    // |n|n fields of TableProperties|footer end|PROPERTIES_MAGIC|
+    static constexpr uint64_t PROPERTIES_MAGIC = 0x73656974f0706f72ULL;
+
+    // the fields of the properties block, readers skip the ones they don't
+    // know
+    static constexpr uint64_t PROPERTIES_FIELDS = 11;
+
+    // Reads the properties block of a table of size bytes open as fd into
+    // props, and returns where the footer ends: the table read as if it
+    // ended there looks like one without the block. Returns size if the
+    // table has none.
+    static uint64_t readProperties(int fd, uint64_t size,
+                                   TableProperties &props);
+
+    // Stamps the table at path with a sequence in place, syncing it if sync
+    // is set. Returns false if the table has no sequence field.
+    static bool writeSequence(const std::string &path, int64_t sequence,
+                              bool sync);
+
+    // With modelError set, finish fits a LinearModel of at most that error
+    // to the keys and stores it after the index table unless it takes more
+    // than a quarter of the index.
+    //
+    // With compact set, entries start with varints (see putCompactHeader)
+    // and the index is written in blocks of INDEX_BLOCK_ENTRIES, each entry
+    // a varint delta of key and offset from the previous one in the block.
+    // The blocks are followed by the offset of each block from the start of
+    // the index, the number of entries and COMPACT_MAGIC. Compact tables
+    // get no model, their index is small enough to stay in memory.
+    //
+    // With pipelined set, full buffers are written by a thread of the
+    // builder while the entries that follow are encoded into a second
+    // buffer, and the kernel is asked to start writing each one back at
+    // once, which leaves little for the final fdatasync.
+    TableBuilder(const std::string &path, size_t bufferSize = 1 << 20,
+                 bool direct = false, RateLimiter *limiter = nullptr,
+                 uint64_t modelError = 0, bool compact = false,
+                 bool pipelined = false);
+
+    ~TableBuilder();
+
+    // whether the file could be opened and all writes succeeded
+    bool ok() const { return fd >= 0 && !failed; }
+
+    // adds an entry, indirect marks val as an encoded ValuePointer; an entry
+    // with expiresAt set gets the EXPIRING flag and the expiry before val
+    void add(uint64_t key, int64_t time, const std::string &val,
+             bool indirect = false, int64_t expiresAt = 0);
+
+    // stamps the table with the sequence number of TableProperties
+    void setSequence(int64_t sequence) { props.sequence = sequence; }
+
+    // the number of bytes the table takes so far, about for a compact one
+    uint64_t size() const {
+        return offset + keys.size() * (compact ? 4 : 16) + 8 +
+               (PROPERTIES_FIELDS + 3) * 8;
+    }
+
+    // writes the index table, the model and meta data, fdatasyncs the file if
+    // sync is set and returns the index table
+    IndexTable finish(bool sync = true);
+
+   private:
+    std::string path;
+    int fd;
+    bool direct;
+    bool failed;
+    RateLimiter *limiter;
+    uint64_t modelError;
+    bool compact;
+
+    char *buf;
+    char *spare;  // the buffer being written, nullptr unless pipelined
+    size_t bufSize;
+    size_t used;          // bytes in buf
+    uint64_t written;     // bytes written to the file
+    uint64_t offset;      // size of the data segment so far
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> offsets;
+    TableProperties props;
+
+    // writes spare in the background, nullptr unless pipelined
+    std::unique_ptr<ThreadPool> writer;
+    std::future<void> pending;  // the write of spare
+    bool writeFailed;           // set by the writer
+
+    void append(const void *data, size_t n);
+
+    // writes n bytes of data at offset, returns false on failure
+    bool writeAt(const char *data, size_t n, uint64_t offset);
+
+    // waits for the write in the background
+    void waitWrite();
+
+    // writes the index blocks and meta data of a compact table
+    void finishCompact();
+
+    // writes the full blocks in buf, or everything if final is set
+    void flush(bool final);
+};
+
+// fsyncs a folder, which makes the creation and renaming of files in it
+// durable
+void syncDir(const std::string &dir);
@@ -0,0 +1,40 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t threads) : stop(false) {
+    for (size_t i = 0; i < threads; i++)
+        workers.push_back(std::thread(&ThreadPool::work, this));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    for (auto &w : workers) w.join();
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+    std::packaged_task<void()> t(task);
+    std::future<void> f = t.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(t));
+    }
+    cv.notify_one();
+    return f;
+}
+
+void ThreadPool::work() {
+    while (true) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return stop || !tasks.empty(); });
+            if (tasks.empty()) return;
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
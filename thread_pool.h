@@ -0,0 +1,33 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// A fixed number of worker threads running queued tasks in FIFO order
+class ThreadPool {
+   public:
+    ThreadPool(size_t threads);
+
+    // waits for queued tasks to finish and joins the workers
+    ~ThreadPool();
+
+    // queues a task, the future becomes ready once it has run and rethrows
+    // what the task throws
+    std::future<void> submit(std::function<void()> task);
+
+    size_t size() const { return workers.size(); }
+
+   private:
+    std::vector<std::thread> workers;
+    std::queue<std::packaged_task<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop;
+
+    void work();
+};
@@ -0,0 +1,172 @@
+#include "value_log.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include "table_builder.h"
+
+std::string encodePointer(const ValuePointer &p) {
+    char buf[24];
+    memcpy(buf, &p.file, 8);
+    memcpy(buf + 8, &p.offset, 8);
+    memcpy(buf + 16, &p.len, 8);
+    return std::string(buf, sizeof(buf));
+}
+
+ValuePointer decodePointer(const std::string &s) {
+    ValuePointer p;
+    if (s.length() < 24) return p;
+    memcpy(&p.file, s.data(), 8);
+    memcpy(&p.offset, s.data() + 8, 8);
+    memcpy(&p.len, s.data() + 16, 8);
+    return p;
+}
+
+ValueLog::ValueLog(const std::string &dir, uint64_t fileSize)
+    : dir(dir),
+      fileSize(fileSize),
+      active(0),
+      activeSize(0),
+      fd(-1),
+      created(false) {
+    std::filesystem::create_directories(dir);
+    // never appends to an existing file, its tail may be torn
+    for (auto &e : std::filesystem::directory_iterator(dir)) {
+        std::string name = e.path().filename().string();
+        if (name.rfind("vlog-", 0) != 0) continue;
+        uint64_t id = std::stoull(name.substr(5));
+        if (id >= active) active = id + 1;
+    }
+    openActive();
+}
+
+ValueLog::~ValueLog() {
+    if (fd >= 0) close(fd);
+}
+
+std::string ValueLog::path(uint64_t file) const {
+    return (std::filesystem::path(dir) / ("vlog-" + std::to_string(file)))
+        .string();
+}
+
+void ValueLog::roll() {
+    if (fd >= 0) close(fd);
+    active++;
+    openActive();
+}
+
+void ValueLog::openActive() {
+    activeSize = 0;
+    created = true;
+    fd = open(path(active).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        std::clog << "[ValueLog] Failed to open " << path(active) << std::endl;
+}
+
+ValuePointer ValueLog::append(uint64_t key, const std::string &val) {
+    if (activeSize >= fileSize) roll();
+    uint64_t len = val.length();
+    std::string record(16, '\0');
+    memcpy(&record[0], &key, 8);
+    memcpy(&record[8], &len, 8);
+    record += val;
+    ValuePointer p(active, activeSize + 16, len);
+    size_t done = 0;
+    while (done < record.length()) {
+        ssize_t n = pwrite(fd, record.data() + done, record.length() - done,
+                           activeSize + done);
+        if (n <= 0) {
+            std::clog << "[ValueLog] Failed to write " << path(active)
+                      << std::endl;
+            break;
+        }
+        done += n;
+    }
+    activeSize += record.length();
+    return p;
+}
+
+std::string ValueLog::read(const ValuePointer &p) const {
+    std::string val(p.len, '\0');
+    int f = open(path(p.file).c_str(), O_RDONLY);
+    if (f < 0) return "";
+    ssize_t n = pread(f, &val[0], p.len, p.offset);
+    close(f);
+    if (n != (ssize_t)p.len) return "";
+    return val;
+}
+
+void ValueLog::sync() {
+    if (fd < 0) return;
+    fdatasync(fd);
+    if (created) syncDir(dir);
+    created = false;
+}
+
+void ValueLog::seal() {
+    if (activeSize == 0) return;
+    // appends go to the next file, the sealed one is complete on disk
+    sync();
+    roll();
+}
+
+uint64_t ValueLog::size() const {
+    uint64_t bytes = 0;
+    for (auto &e : std::filesystem::directory_iterator(dir))
+        bytes += e.file_size();
+    return bytes;
+}
+
+std::vector<uint64_t> ValueLog::sealedFiles() const {
+    std::vector<uint64_t> files;
+    for (auto &e : std::filesystem::directory_iterator(dir)) {
+        std::string name = e.path().filename().string();
+        if (name.rfind("vlog-", 0) != 0) continue;
+        uint64_t id = std::stoull(name.substr(5));
+        if (id != active) files.push_back(id);
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+void ValueLog::scan(uint64_t file,
+                    const std::function<void(uint64_t, const ValuePointer &,
+                                             const std::string &)> &f) const {
+    int fd = open(path(file).c_str(), O_RDONLY);
+    if (fd < 0) return;
+    uint64_t size = lseek(fd, 0, SEEK_END);
+    uint64_t offset = 0;
+    char header[16];
+    while (pread(fd, header, sizeof(header), offset) == sizeof(header)) {
+        uint64_t key = 0;
+        uint64_t len = 0;
+        memcpy(&key, header, 8);
+        memcpy(&len, header + 8, 8);
+        // stops at a torn record
+        if (offset + 16 + len > size) break;
+        std::string val(len, '\0');
+        if (pread(fd, &val[0], len, offset + 16) != (ssize_t)len) break;
+        f(key, ValuePointer(file, offset + 16, len), val);
+        offset += 16 + len;
+    }
+    close(fd);
+}
+
+void ValueLog::remove(uint64_t file) {
+    if (file == active) return;
+    std::filesystem::remove(path(file));
+}
+
+void ValueLog::reset() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    active = 0;
+    openActive();
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Where a value separated from its ss-table lives in the value log
+struct ValuePointer {
+    uint64_t file;
+    uint64_t offset;  // of the value in the file
+    uint64_t len;
+    ValuePointer() : file(0), offset(0), len(0) {}
+    ValuePointer(uint64_t file, uint64_t offset, uint64_t len)
+        : file(file), offset(offset), len(len) {}
+    bool operator==(const ValuePointer &p) const {
+        return file == p.file && offset == p.offset && len == p.len;
+    }
+};
+
+// the 24 bytes stored in an ss-table in place of a separated value
+std::string encodePointer(const ValuePointer &p);
+ValuePointer decodePointer(const std::string &s);
+
+// Large values are appended to the value log when the memTable is flushed,
+// tables only keep a pointer to them so compaction doesn't copy the values.
+// The log is a series of files vlog-<n> under its folder, each a sequence of
+// records:
+// +---------------------+
+// |key|length|value     |
+// +---------------------+
+// New records go to the newest file, which is sealed once it reaches
+// fileSize. Sealed files are reclaimed by KVStore::garbageCollectValueLog.
+class ValueLog {
+   public:
+    ValueLog(const std::string &dir, uint64_t fileSize);
+
+    ~ValueLog();
+
+    ValuePointer append(uint64_t key, const std::string &val);
+
+    std::string read(const ValuePointer &p) const;
+
+    // fdatasyncs the newest file
+    void sync();
+
+    // seals the active file unless it is empty, after which no file listed
+    // by sealedFiles changes until it is removed
+    void seal();
+
+    // the total size in bytes of all files
+    uint64_t size() const;
+
+    // the ids of sealed files, from the oldest to the newest
+    std::vector<uint64_t> sealedFiles() const;
+
+    // calls f on every record of a file in order
+    void scan(uint64_t file,
+              const std::function<void(uint64_t key, const ValuePointer &p,
+                                       const std::string &val)> &f) const;
+
+    // deletes a sealed file
+    void remove(uint64_t file);
+
+    // deletes all files
+    void reset();
+
+   private:
+    std::string dir;
+    uint64_t fileSize;
+    uint64_t active;  // the id of the file records are appended to
+    uint64_t activeSize;
+    int fd;
+    bool created;  // the active file is not yet synced in the folder
+
+    std::string path(uint64_t file) const;
+
+    // seals the active file and starts a new one
+    void roll();
+
+    // creates the active file, empty
+    void openActive();
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// LEB128 varints: 7 bits per byte from the least significant, the top bit
+// set on every byte but the last. A uint64_t takes 1 to 10 bytes.
+
+const size_t MAX_VARINT_BYTES = 10;
+
+inline void putVarint(std::string &dst, uint64_t v) {
+    char buf[MAX_VARINT_BYTES];
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (char)v;
+    dst.append(buf, n);
+}
+
+// decodes the varint at p, which must end before end, and returns the byte
+// after it, nullptr if it is cut off
+inline const char *getVarint(const char *p, const char *end, uint64_t &v) {
+    // most numbers of a table are deltas below 128
+    if (p < end && !(*p & 0x80)) {
+        v = (uint8_t)*p;
+        return p + 1;
+    }
+    // with 8 bytes at hand, the first byte without the top bit is found in
+    // the whole word at once
+    if (end - p >= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        uint64_t stops = ~w & 0x8080808080808080ULL;
+        if (stops) {
+            int n = __builtin_ctzll(stops) / 8 + 1;
+            v = 0;
+            for (int i = 0; i < n; i++) v |= ((w >> (8 * i)) & 0x7f) << (7 * i);
+            return p + n;
+        }
+    }
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return p;
+    }
+    return nullptr;
+}
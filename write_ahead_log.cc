@@ -0,0 +1,87 @@
+#include "write_ahead_log.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include "table_builder.h"
+
+WriteAheadLog::WriteAheadLog(const std::string &path)
+    : path(path), length(0), created(!std::filesystem::exists(path)) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        std::clog << "[WriteAheadLog] Failed to open " << path << std::endl;
+    else
+        length = lseek(fd, 0, SEEK_END);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    if (fd >= 0) close(fd);
+}
+
+void WriteAheadLog::encode(std::string &records, Op op, uint64_t key,
+                           const std::string &val) {
+    uint64_t len = op == DELETE ? 0 : val.length();
+    char header[17];
+    header[0] = op;
+    memcpy(header + 1, &key, 8);
+    memcpy(header + 9, &len, 8);
+    records.append(header, sizeof(header));
+    if (op != DELETE) records += val;
+}
+
+void WriteAheadLog::append(const std::string &records) {
+    size_t done = 0;
+    while (done < records.length()) {
+        ssize_t n = pwrite(fd, records.data() + done, records.length() - done,
+                           length + done);
+        if (n <= 0) {
+            std::clog << "[WriteAheadLog] Failed to write " << path
+                      << std::endl;
+            break;
+        }
+        done += n;
+    }
+    length += done;
+}
+
+void WriteAheadLog::sync() {
+    if (fd < 0) return;
+    fdatasync(fd);
+    if (created)
+        syncDir(std::filesystem::path(path).parent_path().string());
+    created = false;
+}
+
+void WriteAheadLog::replay(
+    const std::function<void(Op, uint64_t, const std::string &)> &f) {
+    if (fd < 0) return;
+    uint64_t offset = 0;
+    char header[17];
+    while (pread(fd, header, sizeof(header), offset) == sizeof(header)) {
+        Op op = (Op)header[0];
+        uint64_t key = 0;
+        uint64_t len = 0;
+        memcpy(&key, header + 1, 8);
+        memcpy(&len, header + 9, 8);
+        if (op != PUT && op != DELETE && op != DELETE_RANGE &&
+            op != PUT_EXPIRING)
+            break;
+        if (offset + sizeof(header) + len > length) break;
+        std::string val(len, '\0');
+        if (pread(fd, &val[0], len, offset + sizeof(header)) != (ssize_t)len)
+            break;
+        f(op, key, val);
+        offset += sizeof(header) + len;
+    }
+    // later appends start after the last complete record
+    if (offset < length && ftruncate(fd, offset) == 0) length = offset;
+}
+
+void WriteAheadLog::reset() {
+    if (fd < 0) return;
+    if (ftruncate(fd, 0) == 0) length = 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// The puts and deletions not yet flushed in an ss-table, so the memTable
+// can be rebuilt after a crash. The log is a single file of records:
+// +---------------------------+
+// |op|key|length|value        |
+// +---------------------------+
+// op is a single byte, PUT, DELETE, DELETE_RANGE or PUT_EXPIRING, key and
+// length take 8 bytes each. A deletion has no value, the value of a range
+// deletion is the last key of the range and the value of a put with a ttl
+// starts with the time it expires at. The log is emptied once the memTable
+// it covers is flushed, or renamed away with it when it is sealed for a
+// background flush.
+class WriteAheadLog {
+   public:
+    enum Op : uint8_t {
+        PUT = 1,
+        DELETE = 2,
+        DELETE_RANGE = 3,
+        PUT_EXPIRING = 4
+    };
+
+    // opens the log at path, creating it if it doesn't exist
+    WriteAheadLog(const std::string &path);
+
+    ~WriteAheadLog();
+
+    // adds a record to the records of a write group
+    static void encode(std::string &records, Op op, uint64_t key,
+                       const std::string &val);
+
+    // appends the encoded records of a write group with a single write
+    void append(const std::string &records);
+
+    // fdatasyncs the log
+    void sync();
+
+    // Calls f on every record from the oldest one. A torn record at the
+    // end, left by a crash during an append, is cut off.
+    void replay(const std::function<void(Op op, uint64_t key,
+                                         const std::string &val)> &f);
+
+    // empties the log
+    void reset();
+
+    // the size in bytes of the log
+    uint64_t size() const { return length; }
+
+   private:
+    std::string path;
+    int fd;
+    uint64_t length;
+    bool created;  // the file is not yet synced in its folder
+};
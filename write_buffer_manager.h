@@ -0,0 +1,29 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// A memory budget for the memTables of several stores, such as the shards of
+// a ShardedKVStore sharing their Options. Each store charges the bytes of
+// its memTable and of the immutable ones waiting for a flush, and releases
+// them once they are flushed; a store whose write finds the budget exceeded
+// flushes its memTable early.
+class WriteBufferManager {
+   public:
+    explicit WriteBufferManager(uint64_t budget) : limit(budget), used(0) {}
+
+    void reserve(uint64_t bytes) { used += bytes; }
+
+    void release(uint64_t bytes) { used -= bytes; }
+
+    // whether the memTables take more than the budget
+    bool exceeded() const { return used.load() > limit; }
+
+    uint64_t usage() const { return used.load(); }
+
+    uint64_t budget() const { return limit; }
+
+   private:
+    const uint64_t limit;
+    std::atomic<uint64_t> used;
+};